@@ -0,0 +1,176 @@
+/*
+ * aesdchar-emu-test.c
+ *
+ * Checks the aesdchar emulation's read/write/llseek behaviour, then measures
+ * its throughput with writer threads storing commands, optionally split into
+ * partial writes, while reader threads repeatedly read the whole device.
+ */
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aesdchar-emu.h"
+
+static struct aesd_emu_dev dev;
+static int command_size = 64;
+static int chunk_size = 64;
+static int commands_per_writer = 200000;
+static atomic_bool writers_done;
+static atomic_ullong bytes_read;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1); \
+        } \
+    } while (0)
+
+// Read the whole device from the start into @param buf
+// @return bytes read
+static size_t read_all(char *buf, size_t size)
+{
+    off_t pos = 0;
+    size_t total = 0;
+    ssize_t n;
+
+    while (total < size && (n = aesd_emu_read(&dev, buf + total, size - total, &pos)) > 0)
+        total += n;
+    return total;
+}
+
+static void check_semantics(void)
+{
+    char buf[256];
+    off_t pos = 0;
+
+    CHECK(aesd_emu_init(&dev) == 0);
+
+    // Partial writes are not readable until a newline completes them
+    CHECK(aesd_emu_write(&dev, "abc", 3) == 3);
+    CHECK(aesd_emu_read(&dev, buf, sizeof(buf), &pos) == 0);
+    CHECK(aesd_emu_write(&dev, "def\nghi\nj", 9) == 9);
+    CHECK(read_all(buf, sizeof(buf)) == 11 && memcmp(buf, "abcdef\nghi\n", 11) == 0);
+
+    // A read stops at the end of the command containing the position
+    pos = 0;
+    CHECK(aesd_emu_read(&dev, buf, sizeof(buf), &pos) == 7 && pos == 7);
+
+    // Seeks address the concatenated commands
+    CHECK(aesd_emu_llseek(&dev, 0, SEEK_END, &pos) == 11);
+    CHECK(aesd_emu_llseek(&dev, -7, SEEK_CUR, &pos) == 4);
+    CHECK(aesd_emu_read(&dev, buf, sizeof(buf), &pos) == 3 && memcmp(buf, "ef\n", 3) == 0);
+    CHECK(aesd_emu_llseek(&dev, 12, SEEK_SET, &pos) == -EINVAL);
+    CHECK(aesd_emu_llseek(&dev, -1, SEEK_SET, &pos) == -EINVAL);
+    CHECK(pos == 7);
+
+    // The oldest commands are evicted once the buffer is full
+    CHECK(aesd_emu_write(&dev, "\n", 1) == 1);
+    for (int i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i++) {
+        char line[16];
+        int len = snprintf(line, sizeof(line), "line%d\n", i);
+        CHECK(aesd_emu_write(&dev, line, len) == len);
+    }
+    size_t len = read_all(buf, sizeof(buf));
+    CHECK(len == 60 && memcmp(buf, "line0\n", 6) == 0 && memcmp(buf + 54, "line9\n", 6) == 0);
+
+    aesd_emu_destroy(&dev);
+}
+
+static void *writer_thread(void *arg)
+{
+    char *command = malloc(command_size);
+
+    CHECK(command != NULL);
+    memset(command, 'a' + (int)(long)arg % 26, command_size - 1);
+    command[command_size - 1] = '\n';
+    for (int i = 0; i < commands_per_writer; i++) {
+        for (int off = 0; off < command_size; off += chunk_size) {
+            int len = command_size - off < chunk_size ? command_size - off : chunk_size;
+            CHECK(aesd_emu_write(&dev, command + off, len) == len);
+        }
+    }
+    free(command);
+    return NULL;
+}
+
+static void *reader_thread(void *arg)
+{
+    size_t size = (size_t)command_size * AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    char *buf = malloc(size);
+
+    CHECK(buf != NULL);
+    while (!atomic_load(&writers_done))
+        atomic_fetch_add(&bytes_read, read_all(buf, size));
+    free(buf);
+    return NULL;
+}
+
+static double seconds_since(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    int writers = 1, readers = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "w:r:s:c:n:")) != -1) {
+        switch (opt) {
+        case 'w': writers = atoi(optarg); break;
+        case 'r': readers = atoi(optarg); break;
+        case 's': command_size = atoi(optarg); break;
+        case 'c': chunk_size = atoi(optarg); break;
+        case 'n': commands_per_writer = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-w writers] [-r readers] [-s command_size] "
+                            "[-c write_chunk_size] [-n commands_per_writer]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (writers < 1 || readers < 0 || command_size < 1 || chunk_size < 1 || commands_per_writer < 1) {
+        fprintf(stderr, "Invalid arguments\n");
+        return 1;
+    }
+
+    check_semantics();
+    printf("semantics: ok\n");
+
+    pthread_t *threads = calloc(writers + readers, sizeof(pthread_t));
+    struct timespec start;
+    CHECK(threads != NULL && aesd_emu_init(&dev) == 0);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < readers; i++)
+        CHECK(pthread_create(&threads[writers + i], NULL, reader_thread, NULL) == 0);
+    for (int i = 0; i < writers; i++)
+        CHECK(pthread_create(&threads[i], NULL, writer_thread, (void *)(long)i) == 0);
+    for (int i = 0; i < writers; i++)
+        pthread_join(threads[i], NULL);
+    double elapsed = seconds_since(&start);
+    atomic_store(&writers_done, true);
+    for (int i = 0; i < readers; i++)
+        pthread_join(threads[writers + i], NULL);
+
+    // Concurrent partial writes interleave, so only whole-command writes keep every entry intact
+    if (chunk_size >= command_size || writers == 1) {
+        size_t size = (size_t)command_size * AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+        char *buf = malloc(size);
+        CHECK(buf != NULL && read_all(buf, size) == size);
+        free(buf);
+    }
+    aesd_emu_destroy(&dev);
+
+    double commands = (double)writers * commands_per_writer;
+    printf("write: %.0f commands/s, %.1f MB/s (%d writers, %d byte commands in %d byte writes)\n",
+           commands / elapsed, commands * command_size / elapsed / 1e6, writers, command_size, chunk_size);
+    printf("read: %.1f MB/s (%d readers)\n", atomic_load(&bytes_read) / elapsed / 1e6, readers);
+    free(threads);
+    return 0;
+}
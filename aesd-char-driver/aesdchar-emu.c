@@ -0,0 +1,185 @@
+/**
+ * @file aesdchar-emu.c
+ * @brief User-space emulation of the aesdchar device file operations
+ *
+ * Partial writes are appended to a pending buffer which grows by doubling.
+ * When a newline completes a command, the pending buffer itself is handed to
+ * the circular buffer as the new entry rather than copied. The buffer of the
+ * entry evicted by that add, if any, becomes the next pending buffer, so once
+ * the ring is full a steady stream of similar sized commands is stored
+ * without allocating.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aesdchar-emu.h"
+
+#define PENDING_MIN_CAP 64
+
+int aesd_emu_init(struct aesd_emu_dev *dev)
+{
+    memset(dev, 0, sizeof(*dev));
+    aesd_circular_buffer_init(&dev->buffer);
+    return -pthread_mutex_init(&dev->lock, NULL);
+}
+
+void aesd_emu_destroy(struct aesd_emu_dev *dev)
+{
+    struct aesd_buffer_entry *entry;
+    uint8_t index;
+
+    AESD_CIRCULAR_BUFFER_FOREACH(entry, &dev->buffer, index) {
+        free((char *)entry->buffptr);
+    }
+    free(dev->pending);
+    pthread_mutex_destroy(&dev->lock);
+}
+
+/**
+ * @return the total size of the stored commands. Caller holds dev->lock.
+ */
+static size_t stored_size(struct aesd_emu_dev *dev)
+{
+    size_t count = dev->buffer.full ? AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED :
+        (dev->buffer.in_offs + AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - dev->buffer.out_offs)
+            % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    size_t size = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        size += dev->buffer.entry[(dev->buffer.out_offs + i) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED].size;
+    }
+    return size;
+}
+
+ssize_t aesd_emu_read(struct aesd_emu_dev *dev, char *buf, size_t count, off_t *f_pos)
+{
+    struct aesd_buffer_entry *entry;
+    size_t entry_offset;
+    ssize_t retval = 0;
+
+    if (*f_pos < 0)
+        return -EINVAL;
+
+    pthread_mutex_lock(&dev->lock);
+    entry = aesd_circular_buffer_find_entry_offset_for_fpos(&dev->buffer, *f_pos, &entry_offset);
+    if (entry) {
+        size_t available = entry->size - entry_offset;
+        retval = count < available ? count : available;
+        memcpy(buf, entry->buffptr + entry_offset, retval);
+        *f_pos += retval;
+    }
+    pthread_mutex_unlock(&dev->lock);
+    return retval;
+}
+
+/**
+ * Store each complete command in dev->pending as an entry.
+ * Caller holds dev->lock.
+ * @return 0 on success, or -ENOMEM with the remaining commands left pending
+ */
+static int commit_pending(struct aesd_emu_dev *dev)
+{
+    char *newline;
+
+    while (dev->pending_scanned < dev->pending_len &&
+           (newline = memchr(dev->pending + dev->pending_scanned, '\n',
+                             dev->pending_len - dev->pending_scanned)) != NULL) {
+        size_t command_len = newline - dev->pending + 1;
+        size_t rest = dev->pending_len - command_len;
+        uint8_t slot = dev->buffer.in_offs;
+        char *spare = NULL;
+        size_t spare_cap = 0;
+
+        // Reuse the buffer of the entry about to be evicted for whatever follows the newline
+        if (dev->buffer.full) {
+            spare = (char *)dev->buffer.entry[slot].buffptr;
+            spare_cap = dev->entry_cap[slot];
+        }
+        if (rest > spare_cap) {
+            size_t cap = rest < PENDING_MIN_CAP ? PENDING_MIN_CAP : rest;
+            char *grown = realloc(spare, cap);
+            if (!grown)
+                return -ENOMEM;
+            // Keep the entry valid in case a later step fails
+            if (dev->buffer.full) {
+                dev->buffer.entry[slot].buffptr = grown;
+                dev->entry_cap[slot] = cap;
+            }
+            spare = grown;
+            spare_cap = cap;
+        }
+        if (rest)
+            memcpy(spare, newline + 1, rest);
+
+        struct aesd_buffer_entry add = { .buffptr = dev->pending, .size = command_len };
+        aesd_circular_buffer_add_entry(&dev->buffer, &add);
+        dev->entry_cap[slot] = dev->pending_cap;
+
+        dev->pending = spare;
+        dev->pending_cap = spare_cap;
+        dev->pending_len = rest;
+        dev->pending_scanned = 0;
+    }
+    dev->pending_scanned = dev->pending_len;
+    return 0;
+}
+
+ssize_t aesd_emu_write(struct aesd_emu_dev *dev, const char *buf, size_t count)
+{
+    ssize_t retval = count;
+
+    if (count == 0)
+        return 0;
+
+    pthread_mutex_lock(&dev->lock);
+    if (dev->pending_len + count > dev->pending_cap) {
+        size_t cap = dev->pending_cap ? dev->pending_cap * 2 : PENDING_MIN_CAP;
+        if (cap < dev->pending_len + count)
+            cap = dev->pending_len + count;
+        char *grown = realloc(dev->pending, cap);
+        if (!grown) {
+            pthread_mutex_unlock(&dev->lock);
+            return -ENOMEM;
+        }
+        dev->pending = grown;
+        dev->pending_cap = cap;
+    }
+    memcpy(dev->pending + dev->pending_len, buf, count);
+    dev->pending_len += count;
+
+    if (commit_pending(dev) != 0)
+        retval = -ENOMEM;
+    pthread_mutex_unlock(&dev->lock);
+    return retval;
+}
+
+off_t aesd_emu_llseek(struct aesd_emu_dev *dev, off_t offset, int whence, off_t *f_pos)
+{
+    off_t base, size;
+
+    pthread_mutex_lock(&dev->lock);
+    size = stored_size(dev);
+    switch (whence) {
+    case SEEK_SET:
+        base = 0;
+        break;
+    case SEEK_CUR:
+        base = *f_pos;
+        break;
+    case SEEK_END:
+        base = size;
+        break;
+    default:
+        pthread_mutex_unlock(&dev->lock);
+        return -EINVAL;
+    }
+    pthread_mutex_unlock(&dev->lock);
+
+    if (base + offset < 0 || base + offset > size)
+        return -EINVAL;
+    *f_pos = base + offset;
+    return *f_pos;
+}
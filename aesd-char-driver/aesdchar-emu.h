@@ -0,0 +1,78 @@
+/*
+ * aesdchar-emu.h
+ *
+ * User-space emulation of the aesdchar device, for exercising and
+ * benchmarking its read/write/llseek data path without loading a module.
+ *
+ * Writes accumulate until a newline, then each complete command becomes one
+ * entry of an aesd_circular_buffer, evicting the oldest once the buffer
+ * holds AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED commands. Reads and seeks
+ * address the concatenation of the stored commands. Return values follow
+ * the kernel file operations: a count, or a negative errno.
+ */
+
+#ifndef AESDCHAR_EMU_H
+#define AESDCHAR_EMU_H
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "aesd-circular-buffer.h"
+
+struct aesd_emu_dev
+{
+    /**
+     * Serializes all operations on the device
+     */
+    pthread_mutex_t lock;
+    struct aesd_circular_buffer buffer;
+    /**
+     * Allocated size of each entry's buffptr, so evicted buffers can be reused
+     */
+    size_t entry_cap[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    /**
+     * Bytes written since the last newline, in a buffer grown by doubling
+     */
+    char *pending;
+    size_t pending_len;
+    size_t pending_cap;
+    /**
+     * Length of the start of pending known to hold no newline
+     */
+    size_t pending_scanned;
+};
+
+/**
+ * Initialize @param dev as an empty device
+ * @return 0 on success, or a negative errno
+ */
+int aesd_emu_init(struct aesd_emu_dev *dev);
+
+/**
+ * Free the commands and partial write held by @param dev
+ */
+void aesd_emu_destroy(struct aesd_emu_dev *dev);
+
+/**
+ * Read up to @param count bytes at *@param f_pos into @param buf, never
+ * past the end of the command containing f_pos, and advance f_pos.
+ * @return bytes read, 0 at the end of the stored data
+ */
+ssize_t aesd_emu_read(struct aesd_emu_dev *dev, char *buf, size_t count, off_t *f_pos);
+
+/**
+ * Append @param count bytes from @param buf to the partial write, storing
+ * each command completed by a newline as an entry.
+ * @return count on success, or -ENOMEM. On -ENOMEM the bytes may have been
+ *   kept, and any commands they complete are stored by the next write.
+ */
+ssize_t aesd_emu_write(struct aesd_emu_dev *dev, const char *buf, size_t count);
+
+/**
+ * Move *@param f_pos as lseek() would, relative to the start, current
+ * position or end of the stored commands for SEEK_SET, SEEK_CUR or SEEK_END.
+ * @return the new position, or -EINVAL if it would fall outside the stored data
+ */
+off_t aesd_emu_llseek(struct aesd_emu_dev *dev, off_t offset, int whence, off_t *f_pos);
+
+#endif /* AESDCHAR_EMU_H */
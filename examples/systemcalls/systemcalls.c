@@ -1,11 +1,73 @@
+#define _GNU_SOURCE  // pipe2()
 #include "systemcalls.h"
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <unistd.h>
+#include <spawn.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
 #include <sys/wait.h>
+#include <sys/syscall.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <fcntl.h>
 
+extern char **environ;
+
+/**
+* Start @param argv with posix_spawn(), redirecting standard out to
+* @param outputfile when it is not NULL.
+* @return the child's pid, or -1 if it could not be started
+*/
+static pid_t spawn_command(char * const argv[], const char *outputfile)
+{
+    posix_spawn_file_actions_t actions;
+    pid_t pid;
+
+    if (posix_spawn_file_actions_init(&actions) != 0) {
+        return -1;
+    }
+    if (outputfile && posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, outputfile,
+                                                       O_WRONLY | O_CREAT | O_TRUNC, 0644) != 0) {
+        posix_spawn_file_actions_destroy(&actions);
+        return -1;
+    }
+
+    int rc = posix_spawn(&pid, argv[0], &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    return rc == 0 ? pid : -1;
+}
+
+/**
+* Wait for @param pid to terminate.
+* @return true if it exited normally with status 0
+*/
+static bool wait_command(pid_t pid)
+{
+    int status;
+    pid_t rc;
+
+    do {
+        rc = waitpid(pid, &status, 0);
+    } while (rc == -1 && errno == EINTR);
+    return rc != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/**
+* @return a pidfd for @param pid, or -1 if the kernel or C library lacks pidfd_open()
+*/
+static int open_pidfd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    return -1;
+#endif
+}
+
 /**
  * @param cmd the command to execute with system()
  * @return true if the command in @param cmd was executed
@@ -27,19 +89,16 @@ bool do_system(const char *cmd)
 *   Since exec() does not perform path expansion, the command to execute needs
 *   to be an absolute path.
 * @param ... - A list of 1 or more arguments after the @param count argument.
-*   The first is always the full path to the command to execute with execv()
-*   The remaining arguments are a list of arguments to pass to the command in execv()
+*   The first is always the full path to the command to execute with posix_spawn()
+*   The remaining arguments are a list of arguments to pass to the command in posix_spawn()
 * @return true if the command @param ... with arguments @param arguments were executed successfully
-*   using the execv() call, false if an error occurred, either in invocation of the
-*   fork, waitpid, or execv() command, or if a non-zero return value was returned
+*   using the posix_spawn() call, false if an error occurred, either in invocation of the
+*   posix_spawn or waitpid call, or if a non-zero return value was returned
 *   by the command issued in @param arguments with the specified arguments.
 */
 
 bool do_exec(int count, ...)
 {
-    pid_t pid;
-    int status;  // Variable to store the status of the child process
-
     va_list args;
     va_start(args, count);
     char *command[count + 1];  // Create an array to store the command and arguments
@@ -49,24 +108,13 @@ bool do_exec(int count, ...)
     command[count] = NULL;  // Terminate the array with NULL for execv
     va_end(args);
 
-    pid = fork();  // Create a child process
+    // posix_spawn() does not copy the parent's page tables the way fork() does,
+    // and reports a failed exec directly instead of through the exit status
+    pid_t pid = spawn_command(command, NULL);
     if (pid == -1) {
-        return false;  // Fork failed
-    }
-
-    if (pid == 0) {
-        // Child process: execute the command
-        execv(command[0], command);
-        exit(EXIT_FAILURE);  // If execv fails, exit with failure status
-    } 
-    else {
-        // Parent process: wait for the child to terminate
-        if (waitpid(pid, &status, 0) == -1) {
-            return false;  // Waiting failed
-        }
-        // Check if the child process exited normally and the exit status was 0
-        return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        return false;
     }
+    return wait_command(pid);
 }
 
 /**
@@ -85,40 +133,349 @@ bool do_exec_redirect(const char *outputfile, int count, ...)
         command[i] = va_arg(args, char *);
     }
     command[count] = NULL;
-    // this line is to avoid a compile warning before your implementation is complete
-    // and may be removed
-    //command[count] = command[count];
+    va_end(args);
+
+    pid_t pid = spawn_command(command, outputfile);
+    if (pid == -1) {
+        return false;
+    }
+    return wait_command(pid);
+}
+
+/**
+* @param cmds - The commands to run. status and success are filled in for each.
+* @param count - The number of commands in @param cmds
+* @param max_parallel - The most commands to run at the same time, 0 for no limit
+* @return true if every command was started and exited with status 0.
+*   All commands are run even if some fail.
+*
+* Children are reaped through pidfds polled together, so a slow command does
+* not keep the next one from starting as soon as any other finishes. Where
+* pidfd_open() is not available children are reaped in the order they started.
+*/
+bool do_exec_batch(struct exec_batch_cmd *cmds, size_t count, size_t max_parallel)
+{
+    if (max_parallel == 0 || max_parallel > count) {
+        max_parallel = count;
+    }
+    if (count == 0) {
+        return true;
+    }
+
+    struct pollfd *pfds = calloc(max_parallel, sizeof(struct pollfd));
+    pid_t *pids = calloc(max_parallel, sizeof(pid_t));
+    size_t *owners = calloc(max_parallel, sizeof(size_t));  // Index in cmds for each running slot
+    if (!pfds || !pids || !owners) {
+        free(pfds);
+        free(pids);
+        free(owners);
+        return false;
+    }
+
+    bool all_ok = true;
+    size_t next = 0;
+    size_t running = 0;
+
+    while (next < count || running > 0) {
+        // Fill free slots with commands still waiting to start
+        while (next < count && running < max_parallel) {
+            struct exec_batch_cmd *cmd = &cmds[next++];
+            cmd->success = false;
+            cmd->status = -1;
+            pid_t pid = spawn_command(cmd->argv, cmd->outputfile);
+            if (pid == -1) {
+                all_ok = false;
+                continue;
+            }
+            pids[running] = pid;
+            owners[running] = cmd - cmds;
+            pfds[running].fd = open_pidfd(pid);
+            pfds[running].events = POLLIN;
+            pfds[running].revents = 0;
+            running++;
+        }
+        if (running == 0) {
+            break;
+        }
+
+        // Without a pidfd for the oldest child, block on it directly
+        size_t done = 0;
+        if (pfds[0].fd != -1) {
+            int ready = poll(pfds, running, -1);
+            if (ready == -1) {
+                // revents were not updated, so they may describe children reaped earlier
+                if (errno == EINTR) {
+                    continue;
+                }
+                all_ok = false;
+                break;
+            }
+            for (done = 0; done < running; done++) {
+                if (pfds[done].fd != -1 && (pfds[done].revents & (POLLIN | POLLHUP))) {
+                    break;
+                }
+            }
+            if (done == running) {
+                continue;
+            }
+        }
+
+        struct exec_batch_cmd *cmd = &cmds[owners[done]];
+        int status;
+        pid_t rc;
+        do {
+            rc = waitpid(pids[done], &status, 0);
+        } while (rc == -1 && errno == EINTR);
+        if (rc != -1) {
+            cmd->status = status;
+            cmd->success = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        }
+        all_ok = all_ok && cmd->success;
+        if (pfds[done].fd != -1) {
+            close(pfds[done].fd);
+        }
+
+        // Keep slots in start order so the fallback always waits for the oldest
+        running--;
+        memmove(&pfds[done], &pfds[done + 1], (running - done) * sizeof(*pfds));
+        memmove(&pids[done], &pids[done + 1], (running - done) * sizeof(*pids));
+        memmove(&owners[done], &owners[done + 1], (running - done) * sizeof(*owners));
+    }
+
+    // Only reached early on a poll() failure: do not leave zombies behind
+    for (size_t i = 0; i < running; i++) {
+        waitpid(pids[i], NULL, 0);
+        if (pfds[i].fd != -1) {
+            close(pfds[i].fd);
+        }
+    }
 
+    free(pfds);
+    free(pids);
+    free(owners);
+    return all_ok;
+}
+
+/**
+* Append @param len bytes to @param output, growing it geometrically.
+* @return false if memory could not be allocated
+*/
+static bool output_append(struct exec_output *output, const char *data, size_t len)
+{
+    if (output->len + len + 1 > output->cap) {
+        size_t cap = output->cap ? output->cap : 4096;
+        while (cap < output->len + len + 1) {
+            cap *= 2;
+        }
+        char *grown = realloc(output->data, cap);
+        if (!grown) {
+            return false;
+        }
+        output->data = grown;
+        output->cap = cap;
+    }
+    memcpy(output->data + output->len, data, len);
+    output->len += len;
+    output->data[output->len] = '\0';
+    return true;
+}
 
-/*
- * TODO
- *   Call execv, but first using https://stackoverflow.com/a/13784315/1446624 as a refernce,
- *   redirect standard out to a file specified by outputfile.
- *   The rest of the behaviour is same as do_exec()
- *
+static long long monotonic_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+* Wait for @param pid to exit without reaping it.
+* @return false if it was still running at @param deadline, a monotonic_ms() time
 */
+static bool wait_exit_until(pid_t pid, long long deadline)
+{
+    int pidfd = open_pidfd(pid);
+    if (pidfd != -1) {
+        struct pollfd pfd = { .fd = pidfd, .events = POLLIN };
+        int ready;
+        do {
+            long long left = deadline - monotonic_ms();
+            ready = poll(&pfd, 1, left > 0 ? (int)left : 0);
+        } while (ready == -1 && errno == EINTR);
+        close(pidfd);
+        return ready != 0;
+    }
+
+    // No pidfds: check every 10ms, leaving the child to be reaped by the caller
+    for (;;) {
+        siginfo_t info = { 0 };
+        if (waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == -1 && errno != EINTR) {
+            return true;
+        }
+        if (info.si_pid == pid) {
+            return true;
+        }
+        if (monotonic_ms() >= deadline) {
+            return false;
+        }
+        struct timespec pause = { .tv_sec = 0, .tv_nsec = 10000000 };
+        nanosleep(&pause, NULL);
+    }
+}
 
-    pid_t pid = fork();
+/**
+* @param capture - Options for the capture, and where the results are stored.
+*   Output goes to capture->callback as it arrives if set, otherwise it is
+*   collected in capture->out and capture->err. Release these with exec_capture_free().
+* All other parameters, see do_exec above
+* @return true if the command ran to completion without exceeding the
+*   limits in @param capture and exited with status 0.
+*
+* Standard out and standard error are read through pipes while the command
+* runs, so output never passes through the filesystem.
+*/
+bool do_exec_capture(struct exec_capture *capture, int count, ...)
+{
+    va_list args;
+    va_start(args, count);
+    char *command[count + 1];
+    for (int i = 0; i < count; i++) {
+        command[i] = va_arg(args, char *);
+    }
+    command[count] = NULL;
+    va_end(args);
+
+    capture->truncated = false;
+    capture->timed_out = false;
+    capture->status = -1;
+
+    // Close-on-exec keeps the pipes out of unrelated children; dup2 onto
+    // stdout and stderr clears the flag for the command itself
+    int out_pipe[2], err_pipe[2];
+    if (pipe2(out_pipe, O_CLOEXEC) == -1) {
+        return false;
+    }
+    if (pipe2(err_pipe, O_CLOEXEC) == -1) {
+        close(out_pipe[0]);
+        close(out_pipe[1]);
+        return false;
+    }
+
+    posix_spawn_file_actions_t actions;
+    pid_t pid = -1;
+    if (posix_spawn_file_actions_init(&actions) == 0) {
+        if (posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDOUT_FILENO) == 0 &&
+            posix_spawn_file_actions_adddup2(&actions, err_pipe[1], STDERR_FILENO) == 0 &&
+            posix_spawn(&pid, command[0], &actions, NULL, command, environ) != 0) {
+            pid = -1;
+        }
+        posix_spawn_file_actions_destroy(&actions);
+    }
+    close(out_pipe[1]);
+    close(err_pipe[1]);
     if (pid == -1) {
-        va_end(args);
-        return false;  // Fork failed
+        close(out_pipe[0]);
+        close(err_pipe[0]);
+        return false;
     }
 
-    if (pid == 0) {
-        int fd = open(outputfile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-        if (fd == -1) {
-            exit(EXIT_FAILURE);  // Fail if unable to open the output file
+    struct pollfd pfds[2] = {
+        { .fd = out_pipe[0], .events = POLLIN },
+        { .fd = err_pipe[0], .events = POLLIN },
+    };
+    const int child_fds[2] = { STDOUT_FILENO, STDERR_FILENO };
+    struct exec_output *outputs[2] = { &capture->out, &capture->err };
+    long long deadline = capture->timeout_ms > 0 ? monotonic_ms() + capture->timeout_ms : 0;
+    size_t total = 0;
+    bool killed = false;
+    char buf[65536];
+
+    while (!killed && (pfds[0].fd != -1 || pfds[1].fd != -1)) {
+        int wait_ms = -1;
+        if (deadline) {
+            long long left = deadline - monotonic_ms();
+            wait_ms = left > 0 ? (int)left : 0;
+        }
+        int ready = poll(pfds, 2, wait_ms);
+        if (ready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            killed = true;
+            break;
+        }
+        if (ready == 0) {
+            capture->timed_out = true;
+            killed = true;
+            break;
         }
-        dup2(fd, STDOUT_FILENO);  // Redirect stdout to the output file
-        close(fd);
 
-        execv(command[0], command);
-        exit(EXIT_FAILURE);  // If execv fails, exit with failure status
+        for (int i = 0; i < 2 && !killed; i++) {
+            if (pfds[i].fd == -1 || !(pfds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+            ssize_t n = read(pfds[i].fd, buf, sizeof(buf));
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                close(pfds[i].fd);
+                pfds[i].fd = -1;
+                continue;
+            }
+            if (capture->max_bytes && total + n > capture->max_bytes) {
+                // Keep what fits, then stop the command
+                n = capture->max_bytes - total;
+                capture->truncated = true;
+                killed = true;
+            }
+            total += n;
+            if (n == 0) {
+                continue;
+            }
+            if (capture->callback) {
+                capture->callback(child_fds[i], buf, n, capture->ctx);
+            } else if (!output_append(outputs[i], buf, n)) {
+                killed = true;
+            }
+        }
+    }
+
+    if (killed) {
+        kill(pid, SIGKILL);
+    }
+    for (int i = 0; i < 2; i++) {
+        if (pfds[i].fd != -1) {
+            close(pfds[i].fd);
+        }
+    }
+
+    // The command may close its output and keep running, so the deadline
+    // still applies once both pipes are at end of file
+    if (!killed && deadline && !wait_exit_until(pid, deadline)) {
+        capture->timed_out = true;
+        killed = true;
+        kill(pid, SIGKILL);
     }
 
+    pid_t rc;
     int status;
-    waitpid(pid, &status, 0);
-    va_end(args);
-    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    do {
+        rc = waitpid(pid, &status, 0);
+    } while (rc == -1 && errno == EINTR);
+    if (rc == -1) {
+        return false;
+    }
+    capture->status = status;
+    return !killed && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
 
+/**
+* Release the output buffers filled by do_exec_capture()
+*/
+void exec_capture_free(struct exec_capture *capture)
+{
+    free(capture->out.data);
+    free(capture->err.data);
+    memset(&capture->out, 0, sizeof(capture->out));
+    memset(&capture->err, 0, sizeof(capture->err));
 }
@@ -1,9 +1,57 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdarg.h>
+#include <stddef.h>
 
 bool do_system(const char *command);
 
 bool do_exec(int count, ...);
 
 bool do_exec_redirect(const char *outputfile, int count, ...);
+
+/**
+ * One command run by do_exec_batch()
+ */
+struct exec_batch_cmd {
+    char * const *argv;         // NULL terminated arguments, argv[0] is the full path to execute
+    const char *outputfile;     // If not NULL, standard out is redirected to this file as in do_exec_redirect()
+    int status;                 // Set to the waitpid() status, or -1 if the command could not be started
+    bool success;               // Set to true if the command started and exited with status 0
+};
+
+bool do_exec_batch(struct exec_batch_cmd *cmds, size_t count, size_t max_parallel);
+
+/**
+ * Receives output from do_exec_capture() as it arrives
+ * @param fd STDOUT_FILENO or STDERR_FILENO, the child stream the data came from
+ */
+typedef void (*exec_output_cb)(int fd, const char *data, size_t len, void *ctx);
+
+/**
+ * Growable buffer of captured output. data is NUL terminated when not NULL
+ * and is released with exec_capture_free().
+ */
+struct exec_output {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+/**
+ * Options and results for do_exec_capture(). Zero initialize, then set the options.
+ */
+struct exec_capture {
+    exec_output_cb callback;    // If not NULL, output is streamed here instead of buffered in out/err
+    void *ctx;                  // Passed to callback
+    size_t max_bytes;           // Kill the command once it has written more than this in total, 0 for no limit
+    int timeout_ms;             // Kill the command if it runs longer than this, 0 for no limit
+    struct exec_output out;     // Captured standard out
+    struct exec_output err;     // Captured standard error
+    bool truncated;             // Set if the command was killed for exceeding max_bytes
+    bool timed_out;             // Set if the command was killed for exceeding timeout_ms
+    int status;                 // The waitpid() status, or -1 if the command could not be started
+};
+
+bool do_exec_capture(struct exec_capture *capture, int count, ...);
+
+void exec_capture_free(struct exec_capture *capture);
@@ -0,0 +1,182 @@
+/*
+ * threading-bench.c
+ *
+ * Runs threads started with start_thread_obtaining_lock() against one lock
+ * and reports, for each lock type, the distribution of acquisition latency,
+ * the number of acquisitions per second, and how evenly the lock was shared.
+ *
+ * Fairness is Jain's index over each thread's acquisition rate: 1.0 when all
+ * threads progressed at the same rate, approaching 1/threads when one thread
+ * took the lock while the others starved.
+ */
+
+#include "threading.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define START_DELAY_MS 100           // Time for every thread to be created before the first acquisition
+
+static const char *lock_names[] = {
+    [THREAD_LOCK_MUTEX] = "mutex",
+    [THREAD_LOCK_ADAPTIVE] = "adaptive",
+    [THREAD_LOCK_TICKET] = "ticket",
+};
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-t threads] [-n iterations] [-l mutex|adaptive|ticket|all] "
+                    "[-o wait_to_obtain_ms] [-r wait_to_release_ms]\n", prog);
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double seconds_between(const struct timespec *from, const struct timespec *to)
+{
+    return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+// @return the latency at @param fraction of the sorted @param latencies, in microseconds
+static double percentile_us(const uint64_t *latencies, size_t count, double fraction)
+{
+    size_t i = (size_t)(fraction * (count - 1) + 0.5);
+    return latencies[i] / 1000.0;
+}
+
+// Run @param threads threads of @param iterations acquisitions each against one lock of @param type
+// @return 0 on success, -1 if a thread failed
+static int run(enum thread_lock_type type, int threads, int iterations, int obtain_ms, int release_ms)
+{
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    struct thread_lock lock;
+    pthread_t *tids = calloc(threads, sizeof(pthread_t));
+    struct thread_data **results = calloc(threads, sizeof(struct thread_data *));
+    uint64_t *latencies = malloc((size_t)threads * iterations * sizeof(uint64_t));
+    double *rates = calloc(threads, sizeof(double));
+    int started = 0, rc = 0;
+
+    if (!tids || !results || !latencies || !rates) {
+        fprintf(stderr, "Out of memory\n");
+        rc = -1;
+        goto out;
+    }
+
+    thread_lock_init(&lock, type, &mutex);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    start.tv_nsec += START_DELAY_MS * 1000000L;
+    start.tv_sec += start.tv_nsec / 1000000000;
+    start.tv_nsec %= 1000000000;
+
+    for (; started < threads; started++) {
+        if (!start_thread_obtaining_lock(&tids[started], &lock, &start, obtain_ms, release_ms, iterations)) {
+            rc = -1;
+            break;
+        }
+    }
+
+    for (int i = 0; i < started; i++) {
+        void *ret;
+        pthread_join(tids[i], &ret);
+        results[i] = ret;
+        if (!results[i]->thread_complete_success) rc = -1;
+    }
+    if (rc == -1) {
+        fprintf(stderr, "%s: a thread failed\n", lock_names[type]);
+        goto out;
+    }
+
+    // The run ends when the last thread releases the lock for the last time
+    struct timespec end = start;
+    size_t count = 0;
+    double rate_sum = 0, rate_sq_sum = 0;
+    for (int i = 0; i < threads; i++) {
+        struct thread_data *data = results[i];
+        if (seconds_between(&end, &data->finished) > 0) end = data->finished;
+        memcpy(latencies + count, data->obtain_latency_ns, iterations * sizeof(uint64_t));
+        count += iterations;
+
+        double elapsed = seconds_between(&start, &data->finished);
+        rates[i] = elapsed > 0 ? iterations / elapsed : 0;
+        rate_sum += rates[i];
+        rate_sq_sum += rates[i] * rates[i];
+    }
+    qsort(latencies, count, sizeof(uint64_t), compare_u64);
+
+    double elapsed = seconds_between(&start, &end);
+    printf("%-9s %7d %12zu %13.0f %9.2f %9.2f %9.2f %9.2f %10.2f %8.3f\n",
+           lock_names[type], threads, count, elapsed > 0 ? count / elapsed : 0,
+           percentile_us(latencies, count, 0.50), percentile_us(latencies, count, 0.90),
+           percentile_us(latencies, count, 0.99), percentile_us(latencies, count, 0.999),
+           latencies[count - 1] / 1000.0,
+           rate_sq_sum > 0 ? rate_sum * rate_sum / (threads * rate_sq_sum) : 1.0);
+
+out:
+    for (int i = 0; i < started; i++) {
+        free(results[i]);
+    }
+    free(tids);
+    free(results);
+    free(latencies);
+    free(rates);
+    return rc;
+}
+
+int main(int argc, char *argv[])
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = cpus > 0 ? cpus : 4;
+    int iterations = 10000;
+    int obtain_ms = 0, release_ms = 0;
+    int first = THREAD_LOCK_MUTEX, last = THREAD_LOCK_TICKET;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:n:l:o:r:")) != -1) {
+        switch (opt) {
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 'o':
+            obtain_ms = atoi(optarg);
+            break;
+        case 'r':
+            release_ms = atoi(optarg);
+            break;
+        case 'l':
+            if (strcmp(optarg, "all") != 0) {
+                first = -1;
+                for (int i = THREAD_LOCK_MUTEX; i <= THREAD_LOCK_TICKET; i++) {
+                    if (strcmp(optarg, lock_names[i]) == 0) first = last = i;
+                }
+                if (first == -1) {
+                    usage(argv[0]);
+                    return 1;
+                }
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (threads < 1 || iterations < 1 || obtain_ms < 0 || release_ms < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    printf("%-9s %7s %12s %13s %9s %9s %9s %9s %10s %8s\n", "lock", "threads", "acquisitions",
+           "acquires/s", "p50_us", "p90_us", "p99_us", "p99.9_us", "max_us", "fairness");
+    int rc = 0;
+    for (int type = first; type <= last; type++) {
+        if (run(type, threads, iterations, obtain_ms, release_ms) == -1) rc = 1;
+    }
+    return rc;
+}
@@ -1,39 +1,177 @@
 #include "threading.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
 #include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 
 // Optional: use these functions to add debug or error prints to your application
 #define DEBUG_LOG(msg,...)
 //#define DEBUG_LOG(msg,...) printf("threading: " msg "\n" , ##__VA_ARGS__)
 #define ERROR_LOG(msg,...) printf("threading ERROR: " msg "\n" , ##__VA_ARGS__)
 
+#define ADAPTIVE_SPIN_LIMIT 100      // Attempts before an adaptive lock sleeps
+#define TICKET_SPIN_LIMIT 1000       // Spins between yields while waiting for a ticket
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define cpu_relax() __asm__ __volatile__("yield")
+#else
+#define cpu_relax() do { } while (0)
+#endif
+
+void thread_lock_init(struct thread_lock *lock, enum thread_lock_type type, pthread_mutex_t *mutex)
+{
+    lock->type = type;
+    lock->mutex = mutex;
+    atomic_init(&lock->state, 0);
+    atomic_init(&lock->next_ticket, 0);
+    atomic_init(&lock->now_serving, 0);
+}
+
+static void futex_wait(atomic_uint *addr, unsigned int val)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake_one(atomic_uint *addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+int thread_lock_acquire(struct thread_lock *lock)
+{
+    switch (lock->type) {
+    case THREAD_LOCK_MUTEX:
+        return pthread_mutex_lock(lock->mutex);
+
+    case THREAD_LOCK_ADAPTIVE: {
+        // Spin while the holder is likely to release soon, reading before each attempt
+        for (int i = 0; i < ADAPTIVE_SPIN_LIMIT; i++) {
+            unsigned int expected = 0;
+            if (atomic_load_explicit(&lock->state, memory_order_relaxed) == 0 &&
+                atomic_compare_exchange_weak_explicit(&lock->state, &expected, 1,
+                                                      memory_order_acquire, memory_order_relaxed)) {
+                return 0;
+            }
+            cpu_relax();
+        }
+        // Mark the lock as having sleepers so the holder wakes one on release
+        while (atomic_exchange_explicit(&lock->state, 2, memory_order_acquire) != 0) {
+            futex_wait(&lock->state, 2);
+        }
+        return 0;
+    }
+
+    case THREAD_LOCK_TICKET: {
+        unsigned int ticket = atomic_fetch_add_explicit(&lock->next_ticket, 1, memory_order_relaxed);
+        for (int spins = 0; atomic_load_explicit(&lock->now_serving, memory_order_acquire) != ticket; spins++) {
+            // Let a preempted ticket holder run when there are more threads than CPUs
+            if (spins == TICKET_SPIN_LIMIT) {
+                sched_yield();
+                spins = 0;
+            }
+            cpu_relax();
+        }
+        return 0;
+    }
+    }
+    return EINVAL;
+}
+
+int thread_lock_release(struct thread_lock *lock)
+{
+    switch (lock->type) {
+    case THREAD_LOCK_MUTEX:
+        return pthread_mutex_unlock(lock->mutex);
+
+    case THREAD_LOCK_ADAPTIVE:
+        if (atomic_exchange_explicit(&lock->state, 0, memory_order_release) == 2) {
+            futex_wake_one(&lock->state);
+        }
+        return 0;
+
+    case THREAD_LOCK_TICKET:
+        atomic_store_explicit(&lock->now_serving,
+                              atomic_load_explicit(&lock->now_serving, memory_order_relaxed) + 1,
+                              memory_order_release);
+        return 0;
+    }
+    return EINVAL;
+}
+
+static void add_ms(struct timespec *ts, int ms)
+{
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (long)(ms % 1000) * 1000000;
+    if (ts->tv_nsec >= 1000000000) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000;
+    }
+}
+
+static uint64_t elapsed_ns(const struct timespec *from, const struct timespec *to)
+{
+    int64_t ns = (int64_t)(to->tv_sec - from->tv_sec) * 1000000000 + (to->tv_nsec - from->tv_nsec);
+    return ns > 0 ? ns : 0;
+}
+
+// Sleep until @param deadline on CLOCK_MONOTONIC; an absolute deadline does not drift when interrupted
+static void sleep_until(const struct timespec *deadline)
+{
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL) == EINTR) {
+    }
+}
+
 void* threadfunc(void* thread_param)
 {
     // Obtain thread arguments from the parameter
     struct thread_data* thread_func_args = (struct thread_data *) thread_param;
+    struct timespec deadline = thread_func_args->start;
+    struct timespec obtained;
 
-    // Attempt to obtain the mutex
-    if (pthread_mutex_lock(thread_func_args->mutex) != 0) {
-        ERROR_LOG("Failed to obtain mutex");
-        thread_func_args->thread_complete_success = false;
-        return thread_param;
-    }
+    add_ms(&deadline, thread_func_args->wait_to_obtain_ms);
+    for (int i = 0; i < thread_func_args->iterations; i++) {
+        // Wait before obtaining; the first wait always sleeps so threads sharing a start begin together
+        if (i == 0 || thread_func_args->wait_to_obtain_ms > 0) {
+            sleep_until(&deadline);
+        }
 
-    // Simulate a task being performed while holding the mutex
-    // For example, this could be resource-intensive work or a critical section
-    for (int i = 0; i < thread_func_args->wait_to_release_ms; ++i) {
-        // Placeholder for work being done
-        // No explicit sleep, just simulation of work through looping
-    }
+        // Attempt to obtain the mutex
+        if (thread_lock_acquire(thread_func_args->lock) != 0) {
+            ERROR_LOG("Failed to obtain mutex");
+            thread_func_args->thread_complete_success = false;
+            return thread_param;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &obtained);
+        thread_func_args->obtain_latency_ns[i] = elapsed_ns(&deadline, &obtained);
+
+        // Hold the mutex for wait_to_release_ms
+        if (thread_func_args->wait_to_release_ms > 0) {
+            deadline = obtained;
+            add_ms(&deadline, thread_func_args->wait_to_release_ms);
+            sleep_until(&deadline);
+        }
 
-    // Release the mutex after the task is complete
-    if (pthread_mutex_unlock(thread_func_args->mutex) != 0) {
-        ERROR_LOG("Failed to release mutex");
-        thread_func_args->thread_complete_success = false;
-        return thread_param;
+        // Release the mutex after the task is complete
+        if (thread_lock_release(thread_func_args->lock) != 0) {
+            ERROR_LOG("Failed to release mutex");
+            thread_func_args->thread_complete_success = false;
+            return thread_param;
+        }
+
+        // The next wait counts from this release
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        add_ms(&deadline, thread_func_args->wait_to_obtain_ms);
     }
 
+    clock_gettime(CLOCK_MONOTONIC, &thread_func_args->finished);
+
     // Mark the thread as successfully completed
     thread_func_args->thread_complete_success = true;
 
@@ -41,13 +179,21 @@ void* threadfunc(void* thread_param)
     return thread_param;
 }
 
-bool start_thread_obtaining_mutex(pthread_t *thread, pthread_mutex_t *mutex, int wait_to_obtain_ms, int wait_to_release_ms)
+// Allocate and fill the thread_data for @param iterations acquisitions of @param lock,
+// or of @param mutex when lock is NULL
+static struct thread_data *alloc_thread_data(pthread_mutex_t *mutex, struct thread_lock *lock, const struct timespec *start,
+                                             int wait_to_obtain_ms, int wait_to_release_ms, int iterations)
 {
-    // Allocate memory for thread_data
-    struct thread_data *data = (struct thread_data *)malloc(sizeof(struct thread_data));
+    if (iterations < 1) {
+        ERROR_LOG("Invalid iteration count %d", iterations);
+        return NULL;
+    }
+
+    // Allocate memory for thread_data and its latencies together, so the joiner frees it with one call
+    struct thread_data *data = (struct thread_data *)malloc(sizeof(struct thread_data) + iterations * sizeof(uint64_t));
     if (data == NULL) {
         ERROR_LOG("Failed to allocate memory for thread data");
-        return false;
+        return NULL;
     }
 
     // Set up the thread data
@@ -55,10 +201,19 @@ bool start_thread_obtaining_mutex(pthread_t *thread, pthread_mutex_t *mutex, int
     data->wait_to_obtain_ms = wait_to_obtain_ms;
     data->wait_to_release_ms = wait_to_release_ms;
     data->thread_complete_success = false;
+    thread_lock_init(&data->mutex_lock, THREAD_LOCK_MUTEX, mutex);
+    data->lock = lock ? lock : &data->mutex_lock;
+    data->iterations = iterations;
+    if (start) {
+        data->start = *start;
+    } else {
+        clock_gettime(CLOCK_MONOTONIC, &data->start);
+    }
+    return data;
+}
 
-    // Here we could perform some logic to simulate waiting before locking the mutex.
-    // For simplicity, we skip this and focus on mutex logic.
-
+static bool start_thread(pthread_t *thread, struct thread_data *data)
+{
     // Create the thread
     if (pthread_create(thread, NULL, threadfunc, (void *)data) != 0) {
         ERROR_LOG("Failed to create thread");
@@ -68,3 +223,16 @@ bool start_thread_obtaining_mutex(pthread_t *thread, pthread_mutex_t *mutex, int
 
     return true;
 }
+
+bool start_thread_obtaining_mutex(pthread_t *thread, pthread_mutex_t *mutex, int wait_to_obtain_ms, int wait_to_release_ms)
+{
+    struct thread_data *data = alloc_thread_data(mutex, NULL, NULL, wait_to_obtain_ms, wait_to_release_ms, 1);
+    return data != NULL && start_thread(thread, data);
+}
+
+bool start_thread_obtaining_lock(pthread_t *thread, struct thread_lock *lock, const struct timespec *start,
+                                 int wait_to_obtain_ms, int wait_to_release_ms, int iterations)
+{
+    struct thread_data *data = alloc_thread_data(lock->mutex, lock, start, wait_to_obtain_ms, wait_to_release_ms, iterations);
+    return data != NULL && start_thread(thread, data);
+}
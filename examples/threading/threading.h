@@ -1,5 +1,39 @@
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <pthread.h>
+#include <time.h>
+
+/**
+ * Lock strategies a thread can obtain and release, so they can be compared
+ * under the same workload.
+ */
+enum thread_lock_type {
+    THREAD_LOCK_MUTEX,               // pthread_mutex_t
+    THREAD_LOCK_ADAPTIVE,            // Spins briefly, then sleeps on a futex until released
+    THREAD_LOCK_TICKET,              // Spins, granting the lock in arrival order
+};
+
+struct thread_lock {
+    enum thread_lock_type type;
+    pthread_mutex_t *mutex;          // THREAD_LOCK_MUTEX: the mutex to lock
+    atomic_uint state;               // THREAD_LOCK_ADAPTIVE: 0 unlocked, 1 locked, 2 locked with sleepers
+    atomic_uint next_ticket;         // THREAD_LOCK_TICKET: next ticket to hand out
+    atomic_uint now_serving;         // THREAD_LOCK_TICKET: ticket holding the lock
+};
+
+/**
+ * Initialize @param lock as a lock of @param type. @param mutex is the
+ * mutex to use for THREAD_LOCK_MUTEX and is ignored otherwise.
+ */
+void thread_lock_init(struct thread_lock *lock, enum thread_lock_type type, pthread_mutex_t *mutex);
+
+/**
+ * Obtain and release @param lock.
+ * @return 0 on success, otherwise an error number as returned by pthread_mutex_lock
+ */
+int thread_lock_acquire(struct thread_lock *lock);
+int thread_lock_release(struct thread_lock *lock);
 
 /**
  * This structure should be dynamically allocated and passed as
@@ -12,6 +46,12 @@ struct thread_data{
     int wait_to_obtain_ms;           // Time to wait before obtaining the mutex
     int wait_to_release_ms;          // Time to wait after obtaining the mutex before releasing it
     bool thread_complete_success;    // Set to true if the thread completed successfully, false if an error occurred
+    struct thread_lock *lock;        // Lock obtained and released, mutex_lock when started with a mutex
+    struct thread_lock mutex_lock;   // Wraps mutex for start_thread_obtaining_mutex
+    struct timespec start;           // CLOCK_MONOTONIC time the first wait_to_obtain_ms counts from
+    int iterations;                  // Times to wait, obtain, hold and release
+    struct timespec finished;        // CLOCK_MONOTONIC time the last iteration released the lock
+    uint64_t obtain_latency_ns[];    // Per iteration, time from the end of the obtain wait until the lock was held
 };
 
 
@@ -29,4 +69,15 @@ struct thread_data{
 * corresponding to the thread which was started.
 * @return true if the thread could be started, false if a failure occurred.
 */
-bool start_thread_obtaining_mutex(pthread_t *thread, pthread_mutex_t *mutex, int wait_to_obtain_ms, int wait_to_release_ms);
\ No newline at end of file
+bool start_thread_obtaining_mutex(pthread_t *thread, pthread_mutex_t *mutex, int wait_to_obtain_ms, int wait_to_release_ms);
+
+/**
+* Like start_thread_obtaining_mutex, for any @param lock, repeated @param iterations times.
+* The first wait ends @param wait_to_obtain_ms after @param start, or after the call if @param start
+* is NULL, so several threads can be released at the same instant. Each later wait counts from the
+* previous release. Waits and holds sleep until absolute CLOCK_MONOTONIC deadlines, and the latency
+* of each acquisition is recorded in the returned thread_data's obtain_latency_ns.
+* @return true if the thread could be started, false if a failure occurred.
+*/
+bool start_thread_obtaining_lock(pthread_t *thread, struct thread_lock *lock, const struct timespec *start,
+                                 int wait_to_obtain_ms, int wait_to_release_ms, int iterations);
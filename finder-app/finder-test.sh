@@ -50,10 +50,13 @@ then
     fi
 fi
 
+# Write all files from one writer process. Manifest content is unescaped by
+# writer, so backslashes in the string are doubled to be written as given.
+MANIFESTSTR=$(printf '%s' "$WRITESTR" | sed 's/\\/\\\\/g')
 for i in $( seq 1 $NUMFILES)
 do
-    writer "$WRITEDIR/${username}$i.txt" "$WRITESTR"
-done
+    printf '%s\t%s\n' "$WRITEDIR/${username}$i.txt" "$MANIFESTSTR"
+done | writer -m -
 
 OUTPUTSTRING=$(finder.sh "$WRITEDIR" "$WRITESTR")
 
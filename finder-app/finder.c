@@ -0,0 +1,518 @@
+/*
+ * finder.c
+ *
+ * Native replacement for finder.sh: counts the regular files under a
+ * directory and the lines in them matching a search string, printing the
+ * same message as finder.sh.
+ *
+ * The tree is walked once by a pool of worker threads. Each worker keeps its
+ * own deque of work: directories still to be read, and batches of the
+ * regular files found in them still to be searched, so even a single large
+ * directory is spread over all workers. A worker takes work from the back of
+ * its own deque and, when that is empty, steals from the front of another
+ * worker's, sleeping until more is queued if there is none. Files are
+ * searched using mmap for large files and glibc's SIMD memmem/memchr to find
+ * matches and line ends. Search strings containing grep regular expression
+ * characters fall back to regexec per line so the counts match grep.
+ *
+ * With -i indexfile, files unchanged since the index was written are counted
+ * from the index instead of being read where possible (see finderindex.h),
+ * and the index is rewritten at the end of the run.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <regex.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "finderindex.h"
+
+#define MAX_WORKERS 64
+#define SMALL_FILE_SIZE (64 * 1024)     // Files up to this size are read() rather than mmap()ed
+#define FILE_BATCH 32                   // Regular files searched as one unit of work
+
+// A directory to read when files is NULL, otherwise a batch of regular files to search
+typedef struct work {
+    char* path;
+    char** files;                       // Full paths, freed along with the array
+    size_t count;
+} work_t;
+
+typedef struct deque {
+    pthread_mutex_t lock;
+    work_t* items;                      // Work waiting to be done
+    size_t head;                        // Index of the oldest entry, thieves take from here
+    size_t tail;                        // One past the newest entry, the owner takes from here
+    size_t cap;
+} deque_t;
+
+typedef struct worker {
+    pthread_t tid;
+    deque_t queue;
+    size_t files;
+    size_t matches;
+    regex_t regex;                      // Per-worker copy, used when the search is not a literal
+    struct finderindex_list index;      // Files seen by this worker, for the new index
+    char* buf;                          // For files that are read rather than mapped
+    size_t buf_cap;
+} worker_t;
+
+static worker_t* workers;
+static int num_workers;
+static atomic_size_t pending = 0;       // Work items queued or being done
+static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;  // Signalled when work is queued or all is done
+static atomic_int idle_workers = 0;     // Workers waiting on idle_cond
+static atomic_uint work_seq = 0;        // Bumped on every push, so a worker about to sleep sees new work
+static const char* search;
+static size_t search_len;
+static bool use_regex;
+static const char* index_path;          // -i option, NULL when not indexing
+static bool cached_counts;              // The index holds counts for this search string
+static atomic_bool index_changed = false;  // A file was added or changed since the index was written
+
+static bool deque_push(deque_t* q, const work_t* item) {
+    pthread_mutex_lock(&q->lock);
+    if (q->head > 0 && q->tail == q->cap) {
+        // Reclaim the space freed by thieves before growing
+        memmove(q->items, q->items + q->head, (q->tail - q->head) * sizeof(work_t));
+        q->tail -= q->head;
+        q->head = 0;
+    }
+    if (q->tail == q->cap) {
+        size_t cap = q->cap ? q->cap * 2 : 64;
+        work_t* grown = realloc(q->items, cap * sizeof(work_t));
+        if (!grown) {
+            pthread_mutex_unlock(&q->lock);
+            return false;
+        }
+        q->items = grown;
+        q->cap = cap;
+    }
+    q->items[q->tail++] = *item;
+    pthread_mutex_unlock(&q->lock);
+    return true;
+}
+
+static bool deque_pop_back(deque_t* q, work_t* item) {
+    bool found = false;
+    pthread_mutex_lock(&q->lock);
+    if (q->tail > q->head) {
+        *item = q->items[--q->tail];
+        found = true;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return found;
+}
+
+static bool deque_steal_front(deque_t* q, work_t* item) {
+    bool found = false;
+    // Locked rather than tried, so a thief never goes to sleep while work is queued
+    pthread_mutex_lock(&q->lock);
+    if (q->tail > q->head) {
+        *item = q->items[q->head++];
+        found = true;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return found;
+}
+
+// Queue @param item on worker @param w's deque and wake an idle worker to steal it
+// @return false if out of memory, the item is then still the caller's
+static bool queue_work(worker_t* w, const work_t* item) {
+    atomic_fetch_add(&pending, 1);
+    if (!deque_push(&w->queue, item)) {
+        atomic_fetch_sub(&pending, 1);
+        return false;
+    }
+    atomic_fetch_add(&work_seq, 1);
+    if (atomic_load(&idle_workers) > 0) {
+        pthread_mutex_lock(&idle_lock);
+        pthread_cond_signal(&idle_cond);
+        pthread_mutex_unlock(&idle_lock);
+    }
+    return true;
+}
+
+// @return true if @param s contains characters special in a grep basic regular expression
+static bool is_regex(const char* s) {
+    return strpbrk(s, ".[*^$\\") != NULL;
+}
+
+// Count the lines in [p, end) containing the search string
+static size_t count_matching_lines(worker_t* w, const char* p, const char* end) {
+    size_t count = 0;
+
+    if (!use_regex) {
+        // The search string holds no newline, so each hit lies within one line
+        while (p < end) {
+            const char* hit = memmem(p, end - p, search, search_len);
+            if (!hit) break;
+            count++;
+            const char* eol = memchr(hit + search_len, '\n', end - (hit + search_len));
+            if (!eol) break;
+            p = eol + 1;
+        }
+        return count;
+    }
+
+    while (p < end) {
+        const char* eol = memchr(p, '\n', end - p);
+        const char* line_end = eol ? eol : end;
+        regmatch_t m = { .rm_so = 0, .rm_eo = line_end - p };
+        if (regexec(&w->regex, p, 1, &m, REG_STARTEND) == 0) count++;
+        if (!eol) break;
+        p = eol + 1;
+    }
+    return count;
+}
+
+// Count the matching lines of a file that is not mapped by reading it into
+// w->buf, a chunk at a time when it is larger than the buffer. A line split
+// across reads is carried over to the next one, and the buffer grows when a
+// single line fills it. Reading stops early at @param expected bytes, the
+// size fstat reported, or -1 if unknown.
+// @return false on a read error. @param data is set to the contents when the
+//   whole file fit in the buffer, otherwise NULL.
+static bool read_file(worker_t* w, int fd, off_t expected, const char** data, size_t* size,
+                      bool* binary, size_t* matches) {
+    size_t len = 0;                     // Bytes in w->buf not yet counted
+    off_t total = 0;
+    bool split = false;                 // Lines were counted and dropped from w->buf
+
+    *binary = false;
+    *matches = 0;
+    while (total != expected) {
+        if (len == w->buf_cap) {
+            size_t cap = w->buf_cap ? w->buf_cap * 2 : SMALL_FILE_SIZE;
+            char* grown = realloc(w->buf, cap + 1);
+            if (!grown) return false;
+            w->buf = grown;
+            w->buf_cap = cap;
+        }
+        ssize_t n = read(fd, w->buf + len, w->buf_cap - len);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (n == 0) break;
+        if (memchr(w->buf + len, '\0', n)) *binary = true;
+        len += n;
+        total += n;
+        w->buf[len] = '\0';  // regexec may look for the end of the string despite REG_STARTEND
+
+        if (len == w->buf_cap && total != expected) {
+            // Count the complete lines and keep the last, partial one
+            const char* eol = memrchr(w->buf, '\n', len);
+            if (!eol) continue;
+            size_t done = eol + 1 - w->buf;
+            if (!*binary) *matches += count_matching_lines(w, w->buf, w->buf + done);
+            memmove(w->buf, w->buf + done, len - done + 1);
+            len -= done;
+            split = true;
+        }
+    }
+
+    if (!*binary) *matches += count_matching_lines(w, w->buf, w->buf + len);
+    else *matches = 0;
+    *data = split ? NULL : len ? w->buf : "";
+    *size = len;
+    return true;
+}
+
+// Search one regular file, opened relative to its directory. If @param entry
+// is set, also describe the file in it for the index.
+// @return false if the file could not be read, or not held in memory whole
+static bool search_file(worker_t* w, int dir_fd, const char* name, const char* path,
+                        struct finderindex_entry* entry) {
+    int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd == -1) {
+        fprintf(stderr, "finder: %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    const char* data = NULL;
+    size_t size = 0;
+    bool mapped = false;
+    bool binary;
+    size_t matches;
+    bool whole = fstat(fd, &st) == 0;
+
+    if (whole && st.st_size > SMALL_FILE_SIZE) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            madvise((void*)data, st.st_size, MADV_SEQUENTIAL);
+            size = st.st_size;
+            mapped = true;
+        } else {
+            data = NULL;
+        }
+    }
+
+    // grep reports matches in a file with NUL bytes on stderr, so finder.sh counts none
+    if (mapped) {
+        binary = memchr(data, '\0', size) != NULL;
+        matches = binary ? 0 : count_matching_lines(w, data, data + size);
+    } else if (!read_file(w, fd, whole ? st.st_size : -1, &data, &size, &binary, &matches)) {
+        fprintf(stderr, "finder: %s: %s\n", path, strerror(errno));
+        close(fd);
+        return false;
+    }
+    w->matches += matches;
+    // Only a file held in memory at once can be summarised for the index
+    if (!data) whole = false;
+
+    if (entry && whole) {
+        // The stat is taken before reading, so a later change always shows in the mtime
+        finderindex_set_stat(entry, &st);
+        entry->matches = matches;
+        entry->flags = binary ? FINDERINDEX_BINARY : 0;
+        finderindex_bloom(entry, data, size);
+    }
+
+    if (mapped) munmap((void*)data, size);
+    close(fd);
+    return whole;
+}
+
+// Count a regular file using its index entry where the file is unchanged,
+// and record it in the worker's new index. Takes ownership of @param path.
+static void index_file(worker_t* w, int dir_fd, const char* name, char* path) {
+    struct finderindex_entry entry;
+    struct stat st;
+    const struct finderindex_entry* old = NULL;
+
+    if (fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+        old = finderindex_lookup(path, &st);
+    }
+
+    if (!old) {
+        atomic_store_explicit(&index_changed, true, memory_order_relaxed);
+        if (!search_file(w, dir_fd, name, path, &entry)) {
+            free(path);
+            return;
+        }
+    } else {
+        entry = *old;
+        if (cached_counts) {
+            w->matches += entry.matches;
+        } else if ((old->flags & FINDERINDEX_BINARY) ||
+                   (!use_regex && !finderindex_may_contain(old, search, search_len))) {
+            // Only a literal search string can be checked against the trigram filter
+            entry.matches = 0;
+        } else {
+            size_t before = w->matches;
+            search_file(w, dir_fd, name, path, NULL);
+            entry.matches = w->matches - before;
+        }
+    }
+
+    entry.path = path;
+    if (!finderindex_add(&w->index, &entry)) free(path);
+}
+
+// Search a batch of regular files given by full path. Takes ownership of @param files.
+static void search_files(worker_t* w, char** files, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (index_path) {
+            index_file(w, AT_FDCWD, files[i], files[i]);
+        } else {
+            search_file(w, AT_FDCWD, files[i], files[i], NULL);
+            free(files[i]);
+        }
+    }
+    free(files);
+}
+
+// Read one directory: count its files and queue them in batches for
+// searching, queue its subdirectories
+static void process_dir(worker_t* w, char* path) {
+    int dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR* dir = dir_fd == -1 ? NULL : fdopendir(dir_fd);
+    if (!dir) {
+        fprintf(stderr, "finder: %s: %s\n", path, strerror(errno));
+        if (dir_fd != -1) close(dir_fd);
+        return;
+    }
+
+    size_t path_len = strlen(path);
+    char** batch = NULL;
+    size_t batch_len = 0;
+    struct dirent* ent;
+    while ((ent = readdir(dir)) != NULL) {
+        const char* name = ent->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+
+        unsigned char type = ent->d_type;
+        if (type == DT_UNKNOWN) {
+            struct stat st;
+            if (fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) == -1) continue;
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+        if (type != DT_DIR && type != DT_REG) continue;  // find -type f and grep -r skip symlinks and devices
+
+        size_t name_len = strlen(name);
+        char* child = malloc(path_len + name_len + 2);
+        if (!child) continue;
+        memcpy(child, path, path_len);
+        child[path_len] = '/';
+        memcpy(child + path_len + 1, name, name_len + 1);
+
+        if (type == DT_REG) {
+            w->files++;
+            if (!batch && !(batch = malloc(FILE_BATCH * sizeof(char*)))) {
+                // Out of memory, search the file here rather than miss it
+                if (index_path) {
+                    index_file(w, dir_fd, name, child);
+                } else {
+                    search_file(w, dir_fd, name, child, NULL);
+                    free(child);
+                }
+                continue;
+            }
+            batch[batch_len++] = child;
+            if (batch_len == FILE_BATCH) {
+                work_t item = { .files = batch, .count = batch_len };
+                if (!queue_work(w, &item)) search_files(w, batch, batch_len);
+                batch = NULL;
+                batch_len = 0;
+            }
+        } else {
+            work_t item = { .path = child };
+            if (!queue_work(w, &item)) free(child);
+        }
+    }
+    closedir(dir);
+    // Too few files left over to be worth handing to another worker
+    if (batch) search_files(w, batch, batch_len);
+}
+
+static void* worker_func(void* arg) {
+    worker_t* w = arg;
+    int self = w - workers;
+
+    for (;;) {
+        unsigned int seq = atomic_load(&work_seq);
+        work_t item;
+        bool found = deque_pop_back(&w->queue, &item);
+        for (int i = 1; !found && i < num_workers; i++) {
+            found = deque_steal_front(&workers[(self + i) % num_workers].queue, &item);
+        }
+
+        if (found) {
+            if (item.files) {
+                search_files(w, item.files, item.count);
+            } else {
+                process_dir(w, item.path);
+                free(item.path);
+            }
+            if (atomic_fetch_sub(&pending, 1) == 1) {
+                // That was the last of the work, release the sleeping workers
+                pthread_mutex_lock(&idle_lock);
+                pthread_cond_broadcast(&idle_cond);
+                pthread_mutex_unlock(&idle_lock);
+            }
+            continue;
+        }
+
+        // Nothing to take. Sleep until work is queued or the walk is finished;
+        // registering as idle before checking work_seq means queue_work either
+        // bumped it in time for the check or sees this worker and signals.
+        pthread_mutex_lock(&idle_lock);
+        atomic_fetch_add(&idle_workers, 1);
+        bool done = atomic_load(&pending) == 0;
+        if (!done && atomic_load(&work_seq) == seq) pthread_cond_wait(&idle_cond, &idle_lock);
+        atomic_fetch_sub(&idle_workers, 1);
+        pthread_mutex_unlock(&idle_lock);
+        if (done) break;
+    }
+    return NULL;
+}
+
+int main(int argc, char* argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "i:")) != -1) {
+        if (opt != 'i') {
+            printf("Error: Arguments were not provided.\n");
+            return 1;
+        }
+        index_path = optarg;
+    }
+
+    const char* filesdir = argc > optind ? argv[optind] : NULL;
+    search = argc > optind + 1 ? argv[optind + 1] : NULL;
+
+    if (!filesdir || !*filesdir || !search || !*search) {
+        printf("Error: Arguments were not provided.\n");
+        return 1;
+    }
+    struct stat st;
+    if (stat(filesdir, &st) == -1 || !S_ISDIR(st.st_mode)) {
+        printf("Error: The directory does not exist.\n");
+        return 1;
+    }
+    search_len = strlen(search);
+    use_regex = is_regex(search);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    num_workers = cpus < 1 ? 1 : cpus > MAX_WORKERS ? MAX_WORKERS : cpus;
+    workers = calloc(num_workers, sizeof(worker_t));
+    if (!workers) {
+        perror("finder");
+        return 1;
+    }
+
+    for (int i = 0; i < num_workers; i++) {
+        pthread_mutex_init(&workers[i].queue.lock, NULL);
+        if (use_regex && regcomp(&workers[i].regex, search, REG_NOSUB) != 0) {
+            fprintf(stderr, "finder: invalid search pattern %s\n", search);
+            return 1;
+        }
+    }
+
+    if (index_path) cached_counts = finderindex_load(index_path, search);
+
+    work_t root = { .path = strdup(filesdir) };
+    atomic_store(&pending, 1);
+    if (!root.path || !deque_push(&workers[0].queue, &root)) {
+        perror("finder");
+        return 1;
+    }
+
+    for (int i = 1; i < num_workers; i++) {
+        pthread_create(&workers[i].tid, NULL, worker_func, &workers[i]);
+    }
+    worker_func(&workers[0]);
+
+    size_t files = workers[0].files, matches = workers[0].matches;
+    for (int i = 1; i < num_workers; i++) {
+        pthread_join(workers[i].tid, NULL);
+        files += workers[i].files;
+        matches += workers[i].matches;
+    }
+
+    if (index_path) {
+        struct finderindex_list lists[MAX_WORKERS];
+        for (int i = 0; i < num_workers; i++) {
+            lists[i] = workers[i].index;
+        }
+        if (finderindex_save(index_path, search, lists, num_workers,
+                             !cached_counts || atomic_load(&index_changed)) == -1) {
+            fprintf(stderr, "finder: cannot write index %s: %s\n", index_path, strerror(errno));
+        }
+    }
+
+    printf("The number of files are %zu and the number of matching lines are %zu\n", files, matches);
+    return 0;
+}
@@ -0,0 +1,283 @@
+/*
+ * finderindex.c
+ *
+ * The index file is a header holding the search string followed by one
+ * fixed-size record per file, each followed by its NUL terminated path.
+ * It is loaded whole into memory and looked up through an open addressing
+ * hash table keyed by path, which is read only while the workers run. A new
+ * index is written to a temporary file and renamed over the old one, so an
+ * interrupted run leaves the previous index intact.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "finderindex.h"
+
+#define INDEX_MAGIC "FNDRIDX1"
+// With two bits per trigram a half full filter still rejects a missing trigram
+// three times in four, and a longer string far more often; fuller than that it
+// rejects too little to be worth keeping. 2048 bits reach it at about 700
+// distinct trigrams, typically 1 to 2 KB of text.
+#define BLOOM_FILL_MAX (FINDERINDEX_BLOOM_BITS / 2)
+
+struct index_header {
+    char magic[8];
+    uint32_t query_len;                 // Search string follows the header
+    uint32_t reserved;
+    uint64_t count;
+};
+
+struct index_record {
+    uint64_t ino;
+    uint64_t size;
+    uint64_t mtime_ns;
+    uint32_t matches;
+    uint32_t flags;
+    uint32_t path_len;                  // Including the NUL, path follows the record
+    uint32_t reserved;
+    uint8_t bloom[FINDERINDEX_BLOOM_BITS / 8];
+};
+
+static char* loaded_data;               // The index file, paths point into it
+static struct finderindex_entry* loaded;
+static size_t loaded_count;
+static size_t* table;                   // Entry index + 1, 0 for an empty slot
+static size_t table_mask;
+
+// FNV-1a over the path
+static uint64_t hash_path(const char* path) {
+    uint64_t hash = 14695981039346656037ull;
+    for (; *path; path++) {
+        hash = (hash ^ (unsigned char)*path) * 1099511628211ull;
+    }
+    return hash;
+}
+
+static void free_loaded(void) {
+    free(loaded_data);
+    free(loaded);
+    free(table);
+    loaded_data = NULL;
+    loaded = NULL;
+    table = NULL;
+    loaded_count = 0;
+}
+
+// Parse the index in loaded_data
+// @return false if it is truncated or not an index
+static bool parse_index(size_t len, const char* query, bool* same_query) {
+    struct index_header hdr;
+    if (len < sizeof(hdr)) return false;
+    memcpy(&hdr, loaded_data, sizeof(hdr));
+    if (memcmp(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic)) != 0) return false;
+    if (hdr.query_len > len - sizeof(hdr)) return false;
+    if (hdr.count > (len - sizeof(hdr)) / sizeof(struct index_record)) return false;
+
+    *same_query = strlen(query) == hdr.query_len &&
+        memcmp(loaded_data + sizeof(hdr), query, hdr.query_len) == 0;
+
+    loaded = malloc(hdr.count * sizeof(*loaded));
+    size_t slots = 16;
+    while (slots < hdr.count * 2) slots *= 2;
+    table = calloc(slots, sizeof(*table));
+    if ((!loaded && hdr.count) || !table) return false;
+    table_mask = slots - 1;
+
+    size_t off = sizeof(hdr) + hdr.query_len;
+    for (size_t i = 0; i < hdr.count; i++) {
+        struct index_record rec;
+        if (len - off < sizeof(rec)) return false;
+        memcpy(&rec, loaded_data + off, sizeof(rec));
+        off += sizeof(rec);
+        if (rec.path_len == 0 || len - off < rec.path_len || loaded_data[off + rec.path_len - 1] != '\0') return false;
+
+        struct finderindex_entry* e = &loaded[i];
+        e->path = loaded_data + off;
+        e->ino = rec.ino;
+        e->size = rec.size;
+        e->mtime_ns = rec.mtime_ns;
+        e->matches = rec.matches;
+        e->flags = rec.flags;
+        memcpy(e->bloom, rec.bloom, sizeof(e->bloom));
+        off += rec.path_len;
+
+        size_t slot = hash_path(e->path) & table_mask;
+        while (table[slot]) slot = (slot + 1) & table_mask;
+        table[slot] = i + 1;
+        loaded_count = i + 1;
+    }
+    return true;
+}
+
+bool finderindex_load(const char* path, const char* query) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) return false;
+
+    bool same_query = false;
+    struct stat st;
+    if (fstat(fileno(fp), &st) == 0 && st.st_size > 0) {
+        loaded_data = malloc(st.st_size);
+        if (loaded_data && fread(loaded_data, 1, st.st_size, fp) == (size_t)st.st_size &&
+            parse_index(st.st_size, query, &same_query)) {
+            fclose(fp);
+            return same_query;
+        }
+        fprintf(stderr, "finder: ignoring unreadable index %s\n", path);
+    }
+    free_loaded();
+    fclose(fp);
+    return false;
+}
+
+const struct finderindex_entry* finderindex_lookup(const char* path, const struct stat* st) {
+    if (!table) return NULL;
+
+    for (size_t slot = hash_path(path) & table_mask; table[slot]; slot = (slot + 1) & table_mask) {
+        const struct finderindex_entry* e = &loaded[table[slot] - 1];
+        if (strcmp(e->path, path) != 0) continue;
+
+        struct finderindex_entry now;
+        finderindex_set_stat(&now, st);
+        if (e->ino == now.ino && e->size == now.size && e->mtime_ns == now.mtime_ns) return e;
+        return NULL;
+    }
+    return NULL;
+}
+
+void finderindex_set_stat(struct finderindex_entry* entry, const struct stat* st) {
+    entry->ino = st->st_ino;
+    entry->size = st->st_size;
+    entry->mtime_ns = (uint64_t)st->st_mtim.tv_sec * 1000000000ull + st->st_mtim.tv_nsec;
+}
+
+// @return two filter bit positions for the trigram at @param p, in the low and high halves
+static uint32_t trigram_hash(const unsigned char* p) {
+    uint32_t t = p[0] | p[1] << 8 | (uint32_t)p[2] << 16;
+    return (uint32_t)((t * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+// Set bit @param bit of @param bloom
+// @return 1 if it was clear, 0 if already set
+static size_t set_bit(uint8_t* bloom, uint32_t bit) {
+    uint8_t mask = 1 << (bit % 8);
+    size_t was_clear = !(bloom[bit / 8] & mask);
+    bloom[bit / 8] |= mask;
+    return was_clear;
+}
+
+void finderindex_bloom(struct finderindex_entry* entry, const char* data, size_t size) {
+    memset(entry->bloom, 0, sizeof(entry->bloom));
+    const unsigned char* p = (const unsigned char*)data;
+    size_t set = 0;
+    for (size_t i = 0; i + 3 <= size; i++) {
+        uint32_t h = trigram_hash(p + i);
+        set += set_bit(entry->bloom, h % FINDERINDEX_BLOOM_BITS);
+        set += set_bit(entry->bloom, (h >> 16) % FINDERINDEX_BLOOM_BITS);
+        if (set > BLOOM_FILL_MAX) {
+            // Saturated, stop scanning and let every search string through
+            memset(entry->bloom, 0xff, sizeof(entry->bloom));
+            return;
+        }
+    }
+}
+
+bool finderindex_may_contain(const struct finderindex_entry* entry, const char* s, size_t len) {
+    const unsigned char* p = (const unsigned char*)s;
+    for (size_t i = 0; i + 3 <= len; i++) {
+        uint32_t h = trigram_hash(p + i);
+        uint32_t a = h % FINDERINDEX_BLOOM_BITS, b = (h >> 16) % FINDERINDEX_BLOOM_BITS;
+        if (!(entry->bloom[a / 8] & (1 << (a % 8))) || !(entry->bloom[b / 8] & (1 << (b % 8)))) return false;
+    }
+    return true;
+}
+
+bool finderindex_add(struct finderindex_list* list, const struct finderindex_entry* entry) {
+    if (list->len == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 256;
+        struct finderindex_entry* grown = realloc(list->entries, cap * sizeof(*grown));
+        if (!grown) return false;
+        list->entries = grown;
+        list->cap = cap;
+    }
+    list->entries[list->len++] = *entry;
+    return true;
+}
+
+static bool write_index(FILE* fp, const char* query, struct finderindex_list* lists, int count) {
+    struct index_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic));
+    hdr.query_len = strlen(query);
+    for (int i = 0; i < count; i++) {
+        hdr.count += lists[i].len;
+    }
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 || fwrite(query, 1, hdr.query_len, fp) != hdr.query_len) return false;
+
+    for (int i = 0; i < count; i++) {
+        for (size_t j = 0; j < lists[i].len; j++) {
+            const struct finderindex_entry* e = &lists[i].entries[j];
+            struct index_record rec;
+            memset(&rec, 0, sizeof(rec));
+            rec.ino = e->ino;
+            rec.size = e->size;
+            rec.mtime_ns = e->mtime_ns;
+            rec.matches = e->matches;
+            rec.flags = e->flags;
+            rec.path_len = strlen(e->path) + 1;
+            memcpy(rec.bloom, e->bloom, sizeof(rec.bloom));
+            if (fwrite(&rec, sizeof(rec), 1, fp) != 1 || fwrite(e->path, 1, rec.path_len, fp) != rec.path_len) return false;
+        }
+    }
+    return fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+}
+
+int finderindex_save(const char* path, const char* query, struct finderindex_list* lists, int count,
+                     bool changed) {
+    size_t path_len = strlen(path);
+    char* tmp_path = NULL;
+    int rc = 0;
+
+    // Every unchanged entry was found in the loaded index, so equal counts mean no file was removed
+    size_t total = 0;
+    for (int i = 0; i < count; i++) {
+        total += lists[i].len;
+    }
+    if (changed || !loaded || total != loaded_count) {
+        tmp_path = malloc(path_len + sizeof(".tmp"));
+        rc = -1;
+    }
+
+    if (tmp_path) {
+        memcpy(tmp_path, path, path_len);
+        memcpy(tmp_path + path_len, ".tmp", sizeof(".tmp"));
+
+        FILE* fp = fopen(tmp_path, "wb");
+        if (fp) {
+            bool written = write_index(fp, query, lists, count);
+            if (fclose(fp) != 0) written = false;
+            if (written && rename(tmp_path, path) == 0) {
+                rc = 0;
+            } else {
+                int saved_errno = errno;
+                unlink(tmp_path);
+                errno = saved_errno;
+            }
+        }
+        free(tmp_path);
+    }
+
+    for (int i = 0; i < count; i++) {
+        for (size_t j = 0; j < lists[i].len; j++) {
+            free(lists[i].entries[j].path);
+        }
+        free(lists[i].entries);
+        lists[i].entries = NULL;
+        lists[i].len = lists[i].cap = 0;
+    }
+    free_loaded();
+    return rc;
+}
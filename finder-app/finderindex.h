@@ -0,0 +1,89 @@
+/*
+ * finderindex.h
+ *
+ * Persistent index for repeated finder searches over the same tree.
+ *
+ * For each regular file the index records its size, mtime and inode, a
+ * bloom filter of the byte trigrams it contains, and its matching line count
+ * for the search string of the run that wrote the index. A later run trusts
+ * an entry while the file's size, mtime and inode are unchanged: it reuses
+ * the count when the search string is the same, and skips files whose
+ * filter shows they cannot contain a new literal search string. The filter
+ * only has room for files of 1 to 2 KB of text; larger files have every bit
+ * set and are always searched.
+ */
+
+#ifndef FINDERINDEX_H
+#define FINDERINDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#define FINDERINDEX_BLOOM_BITS 2048 // Two bits per trigram, saturated at about 700 distinct trigrams
+#define FINDERINDEX_BINARY 0x1      // File contains NUL bytes, grep never counts its lines
+
+struct finderindex_entry {
+    char* path;
+    uint64_t ino;
+    uint64_t size;
+    uint64_t mtime_ns;
+    uint32_t matches;               // Matching lines for the search string the index was written for
+    uint32_t flags;
+    uint8_t bloom[FINDERINDEX_BLOOM_BITS / 8];
+};
+
+// Entries collected by one thread, merged when the index is saved
+struct finderindex_list {
+    struct finderindex_entry* entries;
+    size_t len;
+    size_t cap;
+};
+
+/**
+ * Load the index at @param path. A missing or unreadable index is treated
+ * as empty.
+ * @return true if the index was written for the search string @param query,
+ *   so the matches of its unchanged entries may be reused
+ */
+bool finderindex_load(const char* path, const char* query);
+
+/**
+ * @return the loaded entry for @param path if its size, mtime and inode
+ *   still match @param st, otherwise NULL. Safe to call from any thread
+ *   once finderindex_load() has returned.
+ */
+const struct finderindex_entry* finderindex_lookup(const char* path, const struct stat* st);
+
+// Record the size, mtime and inode from @param st in @param entry
+void finderindex_set_stat(struct finderindex_entry* entry, const struct stat* st);
+
+// Fill the trigram filter of @param entry from the file contents in @param data
+void finderindex_bloom(struct finderindex_entry* entry, const char* data, size_t size);
+
+/**
+ * @return false if the file described by @param entry cannot contain
+ *   @param s, true if it may
+ */
+bool finderindex_may_contain(const struct finderindex_entry* entry, const char* s, size_t len);
+
+/**
+ * Append a copy of @param entry to @param list, which takes ownership of
+ * entry->path.
+ * @return false if out of memory, entry->path is then still the caller's
+ */
+bool finderindex_add(struct finderindex_list* list, const struct finderindex_entry* entry);
+
+/**
+ * Atomically replace the index at @param path with the entries of
+ * @param lists, recording @param query as the search string their matches
+ * were counted for. The file is left alone if the lists hold exactly the
+ * loaded entries, which the caller indicates by @param changed being false.
+ * Frees the entries of the lists.
+ * @return 0 on success, -1 on error with errno set
+ */
+int finderindex_save(const char* path, const char* query, struct finderindex_list* lists, int count,
+                     bool changed);
+
+#endif /* FINDERINDEX_H */
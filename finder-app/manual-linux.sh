@@ -106,7 +106,7 @@ sudo mknod -m 600 ${OUTDIR}/rootfs/dev/console c 5 1
 
 # Cross-compile and copy writer utility from Assignment 2
 cd ${FINDER_APP_DIR}
-${CROSS_COMPILE}gcc -o writer writer.c
+${CROSS_COMPILE}gcc -pthread -o writer writer.c
 cp writer ${OUTDIR}/rootfs/home/
 
 # Copy finder scripts and other necessary files from Assignment 2
@@ -1,8 +1,431 @@
+/*
+ * writer.c
+ *
+ * Writes a string to a file. With -m, writes every path/content pair of a
+ * manifest from a single process: "path<TAB>content" per line, where content
+ * may use \n, \t and \\ escapes. Manifest files are opened, written and
+ * closed in batches through io_uring, or by a pool of threads where the
+ * kernel does not support it. Each file is reported to syslog and stderr as
+ * in single file mode, and the exit status is 1 if any file failed.
+ */
+
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
 #include <syslog.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifdef __has_include
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+// Batching through io_uring needs the headers of Linux 5.6 or later, which
+// added openat, write and close requests and the opcode probe. With older
+// headers manifests are written by the thread pool alone.
+#if defined(IO_URING_OP_SUPPORTED) && defined(SYS_io_uring_setup) && defined(SYS_io_uring_register)
+#define HAVE_URING 1
+#endif
+
+#define URING_ENTRIES 256		// Files per batch
+#define MAX_WRITE_THREADS 32
+#define OPEN_FLAGS (O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC)	// Same as fopen(path, "w")
+
+struct manifest_entry {
+	const char *path;
+	const char *content;
+	size_t len;
+	int fd;
+	int open_err;		// errno from opening, 0 if opened
+	int write_err;		// errno from writing or closing, 0 if written
+};
+
+// Read all of @param fp into a NUL terminated buffer
+static char *read_all(FILE *fp) {
+	size_t cap = 64 * 1024, used = 0;
+	char *buf = malloc(cap);
+
+	while (buf) {
+		used += fread(buf + used, 1, cap - used - 1, fp);
+		if (used < cap - 1) break;
+		char *grown = realloc(buf, cap * 2);
+		if (!grown) {
+			free(buf);
+			return NULL;
+		}
+		buf = grown;
+		cap *= 2;
+	}
+	if (!buf || ferror(fp)) {
+		free(buf);
+		return NULL;
+	}
+	buf[used] = '\0';
+	return buf;
+}
+
+// Replace the escapes in @param s in place
+// @return the unescaped length
+static size_t unescape(char *s) {
+	char *out = s;
+	const char *in;
+
+	for (in = s; *in; in++) {
+		if (*in == '\\' && in[1]) {
+			in++;
+			*out++ = *in == 'n' ? '\n' : *in == 't' ? '\t' : *in;
+		} else {
+			*out++ = *in;
+		}
+	}
+	*out = '\0';
+	return out - s;
+}
+
+// Split @param buf into manifest entries, reporting malformed lines
+// @return the number of entries, or -1 if out of memory
+static ssize_t parse_manifest(char *buf, struct manifest_entry **entries, int *bad_lines) {
+	size_t count = 0, cap = 0;
+	int line_no = 0;
+
+	*entries = NULL;
+	*bad_lines = 0;
+	for (char *line = buf; *line; ) {
+		char *eol = strchr(line, '\n');
+		char *next = eol ? eol + 1 : line + strlen(line);
+		if (eol) *eol = '\0';
+		line_no++;
+
+		char *tab = strchr(line, '\t');
+		if (*line == '\0') {
+			line = next;
+			continue;
+		}
+		if (tab == NULL || tab == line) {
+			fprintf(stderr, "Invalid manifest line %d\n", line_no);
+			syslog(LOG_ERR, "Invalid manifest line %d", line_no);
+			(*bad_lines)++;
+			line = next;
+			continue;
+		}
+
+		if (count == cap) {
+			cap = cap ? cap * 2 : 1024;
+			struct manifest_entry *grown = realloc(*entries, cap * sizeof(*grown));
+			if (!grown) return -1;
+			*entries = grown;
+		}
+		*tab = '\0';
+		struct manifest_entry *e = &(*entries)[count++];
+		memset(e, 0, sizeof(*e));
+		e->path = line;
+		e->content = tab + 1;
+		e->len = unescape(tab + 1);
+		e->fd = -1;
+		line = next;
+	}
+	return count;
+}
+
+// Finish a write that returned short, as fputs would
+static int write_rest(int fd, const char *data, size_t len, size_t done) {
+	while (done < len) {
+		ssize_t n = pwrite(fd, data + done, len - done, done);
+		if (n == -1) {
+			if (errno == EINTR) continue;
+			return errno;
+		}
+		done += n;
+	}
+	return 0;
+}
+
+static void write_entry(struct manifest_entry *e) {
+	e->fd = open(e->path, OPEN_FLAGS, 0666);
+	if (e->fd == -1) {
+		e->open_err = errno;
+		return;
+	}
+	e->write_err = write_rest(e->fd, e->content, e->len, 0);
+	if (close(e->fd) == -1 && !e->write_err) e->write_err = errno;
+	e->fd = -1;
+}
+
+struct write_pool {
+	struct manifest_entry *entries;
+	size_t count;
+	atomic_size_t next;
+};
+
+static void *write_thread(void *arg) {
+	struct write_pool *pool = arg;
+	size_t i;
+
+	while ((i = atomic_fetch_add(&pool->next, 1)) < pool->count) {
+		write_entry(&pool->entries[i]);
+	}
+	return NULL;
+}
+
+// Write the entries with blocking calls from a pool of threads
+static void write_threaded(struct manifest_entry *entries, size_t count) {
+	struct write_pool pool = { .entries = entries, .count = count };
+	pthread_t threads[MAX_WRITE_THREADS];
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int num_threads = cpus < 1 ? 1 : cpus > MAX_WRITE_THREADS ? MAX_WRITE_THREADS : cpus;
+	int started = 0;
+
+	atomic_init(&pool.next, 0);
+	while (started < num_threads && (size_t)started < count &&
+	       pthread_create(&threads[started], NULL, write_thread, &pool) == 0) {
+		started++;
+	}
+	write_thread(&pool);
+	for (int i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+}
+
+#ifdef HAVE_URING
+struct uring {
+	int fd;
+	unsigned *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+};
+
+// Set up a ring supporting openat, write and close
+// @return 0 on success, -1 if io_uring is unavailable
+static int uring_init(struct uring *r) {
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	r->fd = syscall(SYS_io_uring_setup, URING_ENTRIES, &p);
+	if (r->fd == -1) return -1;
+
+	size_t probe_len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe *probe = calloc(1, probe_len);
+	bool supported = probe && syscall(SYS_io_uring_register, r->fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+	const int ops[] = { IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_CLOSE };
+	for (size_t i = 0; supported && i < sizeof(ops) / sizeof(ops[0]); i++) {
+		supported = ops[i] <= probe->last_op && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+	}
+	free(probe);
+	if (!supported) {
+		close(r->fd);
+		return -1;
+	}
+
+	size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (cq_len > sq_len) sq_len = cq_len;
+		cq_len = sq_len;
+	}
+	char *sq = mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	char *cq = sq;
+	if (sq != MAP_FAILED && !(p.features & IORING_FEAT_SINGLE_MMAP)) {
+		cq = mmap(NULL, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+	}
+	r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (sq == MAP_FAILED || cq == MAP_FAILED || r->sqes == MAP_FAILED) {
+		// The mappings live until exit, which follows shortly after writing
+		close(r->fd);
+		return -1;
+	}
+
+	r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	r->sq_array = (unsigned *)(sq + p.sq_off.array);
+	r->cq_head = (unsigned *)(cq + p.cq_off.head);
+	r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	return 0;
+}
+
+// Get the submission entry for the @param n th request of a batch
+static struct io_uring_sqe *uring_sqe(struct uring *r, unsigned n, __u64 user_data) {
+	unsigned tail = *r->sq_tail;
+	struct io_uring_sqe *sqe = &r->sqes[n];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->user_data = user_data;
+	r->sq_array[(tail + n) & *r->sq_mask] = n;
+	return sqe;
+}
+
+// Submit the @param n requests prepared with uring_sqe() and wait for all
+// of them, passing each completion to @param complete
+// @return 0 on success, -1 if the ring failed
+static int uring_run(struct uring *r, unsigned n, struct manifest_entry *entries,
+		     void (*complete)(struct manifest_entry *e, int res)) {
+	unsigned to_submit = n, done = 0;
+
+	__atomic_store_n(r->sq_tail, *r->sq_tail + n, __ATOMIC_RELEASE);
+	while (done < n) {
+		int rc = syscall(SYS_io_uring_enter, r->fd, to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (rc == -1) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		to_submit -= rc;
+
+		unsigned head = *r->cq_head;
+		unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++, done++) {
+			struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+			complete(&entries[cqe->user_data], cqe->res);
+		}
+		__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+	}
+	return 0;
+}
+
+static void open_done(struct manifest_entry *e, int res) {
+	if (res < 0) e->open_err = -res;
+	else e->fd = res;
+}
+
+static void write_done(struct manifest_entry *e, int res) {
+	if (res < 0) e->write_err = -res;
+	else e->write_err = write_rest(e->fd, e->content, e->len, res);
+}
+
+static void close_done(struct manifest_entry *e, int res) {
+	if (res < 0 && !e->write_err) e->write_err = -res;
+	e->fd = -1;
+}
+
+// Write the entries through io_uring, a batch at a time in three phases:
+// open all files, write all opened files, close all opened files
+// @return 0 on success, -1 if the ring failed and nothing was written
+static int write_uring(struct manifest_entry *entries, size_t count) {
+	struct uring r;
+	if (uring_init(&r) == -1) return -1;
+
+	size_t base;
+	for (base = 0; base < count; base += URING_ENTRIES) {
+		struct manifest_entry *batch = entries + base;
+		unsigned batch_len = count - base < URING_ENTRIES ? count - base : URING_ENTRIES;
+		unsigned n = 0;
+
+		for (unsigned i = 0; i < batch_len; i++) {
+			struct io_uring_sqe *sqe = uring_sqe(&r, n++, i);
+			sqe->opcode = IORING_OP_OPENAT;
+			sqe->fd = AT_FDCWD;
+			sqe->addr = (__u64)(uintptr_t)batch[i].path;
+			sqe->len = 0666;
+			sqe->open_flags = OPEN_FLAGS;
+		}
+		if (uring_run(&r, n, batch, open_done) == -1) break;
+
+		n = 0;
+		for (unsigned i = 0; i < batch_len; i++) {
+			if (batch[i].fd == -1 || batch[i].len == 0) continue;
+			struct io_uring_sqe *sqe = uring_sqe(&r, n++, i);
+			sqe->opcode = IORING_OP_WRITE;
+			sqe->fd = batch[i].fd;
+			sqe->addr = (__u64)(uintptr_t)batch[i].content;
+			sqe->len = batch[i].len;
+			sqe->off = 0;
+		}
+		if (n && uring_run(&r, n, batch, write_done) == -1) break;
+
+		n = 0;
+		for (unsigned i = 0; i < batch_len; i++) {
+			if (batch[i].fd == -1) continue;
+			struct io_uring_sqe *sqe = uring_sqe(&r, n++, i);
+			sqe->opcode = IORING_OP_CLOSE;
+			sqe->fd = batch[i].fd;
+		}
+		if (n && uring_run(&r, n, batch, close_done) == -1) break;
+	}
+
+	close(r.fd);
+
+	if (base < count) {
+		// The ring failed part way, redo the unfinished files with blocking calls
+		for (size_t i = base; i < count; i++) {
+			if (entries[i].fd != -1) close(entries[i].fd);
+			entries[i].fd = -1;
+			entries[i].open_err = entries[i].write_err = 0;
+		}
+		write_threaded(entries + base, count - base);
+	}
+	return 0;
+}
+#else
+static int write_uring(struct manifest_entry *entries, size_t count) {
+	(void)entries;
+	(void)count;
+	return -1;
+}
+#endif
+
+// Write every file listed in the manifest @param manifest, or stdin for "-"
+// @return 0 if all files were written, 1 otherwise
+static int write_manifest(const char *manifest) {
+	FILE *fp = strcmp(manifest, "-") == 0 ? stdin : fopen(manifest, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "Error opening manifest %s: %s\n", manifest, strerror(errno));
+		syslog(LOG_ERR, "Failed to open manifest %s: %s", manifest, strerror(errno));
+		return 1;
+	}
+	char *buf = read_all(fp);
+	if (fp != stdin) fclose(fp);
+	if (buf == NULL) {
+		fprintf(stderr, "Error reading manifest %s\n", manifest);
+		syslog(LOG_ERR, "Failed to read manifest %s", manifest);
+		return 1;
+	}
+
+	struct manifest_entry *entries;
+	int bad_lines;
+	ssize_t count = parse_manifest(buf, &entries, &bad_lines);
+	if (count == -1) {
+		fprintf(stderr, "Error reading manifest %s: %s\n", manifest, strerror(ENOMEM));
+		syslog(LOG_ERR, "Failed to read manifest %s: %s", manifest, strerror(ENOMEM));
+		free(entries);
+		free(buf);
+		return 1;
+	}
+
+	if (write_uring(entries, count) == -1) {
+		write_threaded(entries, count);
+	}
+
+	int rc = bad_lines ? 1 : 0;
+	for (ssize_t i = 0; i < count; i++) {
+		struct manifest_entry *e = &entries[i];
+		if (e->open_err) {
+			fprintf(stderr, "Error opening file %s: %s\n", e->path, strerror(e->open_err));
+			syslog(LOG_ERR, "Failed to open or create file %s: %s", e->path, strerror(e->open_err));
+			rc = 1;
+			continue;
+		}
+		syslog(LOG_DEBUG, "Writing '%s' to %s", e->content, e->path);
+		if (e->write_err) {
+			fprintf(stderr, "Error writing to file %s\n", e->path);
+			syslog(LOG_ERR, "Failed to write to file %s", e->path);
+			rc = 1;
+		}
+	}
+
+	free(entries);
+	free(buf);
+	return rc;
+}
 
 int main(int argc, char *argv[]) {
 	FILE *fp;
@@ -12,9 +435,17 @@ int main(int argc, char *argv[]) {
 	// Initialize syslog logging
     	openlog("writer", LOG_PID, LOG_USER);
     
+	// Write a whole manifest of files from this process
+	if (argc == 3 && strcmp(argv[1], "-m") == 0) {
+		int rc = write_manifest(argv[2]);
+		closelog();
+		return rc;
+	}
+
 	// Check for proper number of arguments
 	if (argc != 3) {
 		fprintf(stderr, "Usage: %s <path_to_file> <string_to_write>\n", argv[0]);
+		fprintf(stderr, "       %s -m <manifest|->\n", argv[0]);
 		syslog(LOG_ERR, "Invalid number of arguments provided");
 		closelog();
 		return 1; // Return 1 for error
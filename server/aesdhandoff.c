@@ -0,0 +1,245 @@
+/*
+ * aesdhandoff.c
+ *
+ * Each handed over descriptor travels in its own message: a fixed-size
+ * header naming what it is, with the descriptor attached as SCM_RIGHTS
+ * ancillary data. Forwarded packets are a fixed-size header with the
+ * stream name and length followed by the data, answered by one status byte.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "aesdhandoff.h"
+
+#define SD_LISTEN_FDS_START 3       // First descriptor passed by systemd
+
+struct handoff_msg {
+    uint32_t type;
+    char name[AESDHANDOFF_NAME_MAX + 1];
+};
+
+struct forward_hdr {
+    uint64_t len;
+    char name[AESDHANDOFF_NAME_MAX + 1];
+};
+
+int aesdhandoff_activated_listener(void) {
+    const char* pid = getenv("LISTEN_PID");
+    const char* fds = getenv("LISTEN_FDS");
+    int fd = -1;
+
+    // The variables are meant for the process systemd started, not its children
+    if (pid && fds && strtol(pid, NULL, 10) == getpid() && strtol(fds, NULL, 10) >= 1) {
+        fd = SD_LISTEN_FDS_START;
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_FDNAMES");
+    return fd;
+}
+
+static int fill_addr(struct sockaddr_un* addr, const char* path) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+int aesdhandoff_listen(const char* path) {
+    struct sockaddr_un addr;
+    if (fill_addr(&addr, path) == -1) return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) return -1;
+
+    unlink(path);
+    // Only the owner may take over the server's descriptors
+    mode_t old_mask = umask(077);
+    int rc = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+    umask(old_mask);
+    if (rc == -1 || listen(fd, 1) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int aesdhandoff_send(int conn, int type, const char* name, int fd) {
+    struct handoff_msg msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.type = type;
+    if (name) snprintf(msg.name, sizeof(msg.name), "%s", name);
+
+    struct iovec iov = { .iov_base = &msg, .iov_len = sizeof(msg) };
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr mh = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+    if (type != AESDHANDOFF_END) {
+        mh.msg_control = control.buf;
+        mh.msg_controllen = sizeof(control.buf);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&mh);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(conn, &mh, MSG_NOSIGNAL);
+    } while (sent == -1 && errno == EINTR);
+    return sent == sizeof(msg) ? 0 : -1;
+}
+
+// Receive one message, storing any attached descriptor in @param fd
+// @return 1 on a message, 0 at end of stream, -1 on error
+static int recv_msg(int conn, struct handoff_msg* msg, int* fd) {
+    struct iovec iov = { .iov_base = msg, .iov_len = sizeof(*msg) };
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr mh = {
+        .msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = control.buf, .msg_controllen = sizeof(control.buf),
+    };
+
+    ssize_t n;
+    do {
+        n = recvmsg(conn, &mh, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+    } while (n == -1 && errno == EINTR);
+    if (n <= 0) return n;
+
+    *fd = -1;
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&mh);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    if (n != sizeof(*msg)) {
+        if (*fd != -1) close(*fd);
+        return -1;
+    }
+    msg->name[AESDHANDOFF_NAME_MAX] = '\0';
+    return 1;
+}
+
+int aesdhandoff_take_over(const char* path, aesdhandoff_cb cb, void* ctx) {
+    struct sockaddr_un addr;
+    if (fill_addr(&addr, path) == -1) return -1;
+
+    int conn = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (conn == -1) return -1;
+    if (connect(conn, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        close(conn);
+        return -1;
+    }
+
+    struct handoff_msg msg;
+    int fd;
+    int rc = -1;
+    while (recv_msg(conn, &msg, &fd) == 1) {
+        if (msg.type == AESDHANDOFF_END) {
+            rc = 0;
+            break;
+        }
+        if (fd == -1 || cb(msg.type, msg.name, fd, ctx) == -1) {
+            if (fd != -1) close(fd);
+            break;
+        }
+    }
+
+    // The old process closes the connection once it has stopped accepting
+    // and released the control socket path
+    if (rc == 0) {
+        char c;
+        ssize_t n;
+        do {
+            n = read(conn, &c, 1);
+        } while (n > 0 || (n == -1 && errno == EINTR));
+    }
+    close(conn);
+    return rc;
+}
+
+// @return 0 once all of @param buf is sent, -1 on error
+static int write_all(int fd, const void* buf, size_t len) {
+    const char* p = buf;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// @return 1 once all of @param buf is filled, 0 at end of stream before any of it, -1 on error
+static int read_all(int fd, void* buf, size_t len) {
+    char* p = buf;
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = recv(fd, p + got, len - got, 0);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) return got == 0 ? 0 : -1;
+        got += n;
+    }
+    return 1;
+}
+
+int aesdhandoff_forward(int fd, const char* name, const char* data, size_t len) {
+    struct forward_hdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.len = len;
+    snprintf(hdr.name, sizeof(hdr.name), "%s", name);
+
+    char status;
+    if (write_all(fd, &hdr, sizeof(hdr)) == -1 || write_all(fd, data, len) == -1 ||
+        read_all(fd, &status, 1) != 1) {
+        return -2;
+    }
+    return status == 0 ? 0 : -1;
+}
+
+int aesdhandoff_forward_recv(int fd, char* name, char** data, size_t* len) {
+    struct forward_hdr hdr;
+    int rc = read_all(fd, &hdr, sizeof(hdr));
+    if (rc != 1) return rc;
+
+    *data = malloc(hdr.len ? hdr.len : 1);
+    if (!*data) return -1;
+    if (read_all(fd, *data, hdr.len) != 1) {
+        free(*data);
+        return -1;
+    }
+    memcpy(name, hdr.name, AESDHANDOFF_NAME_MAX);
+    name[AESDHANDOFF_NAME_MAX] = '\0';
+    *len = hdr.len;
+    return 1;
+}
+
+int aesdhandoff_forward_done(int fd, int rc) {
+    char status = rc == 0 ? 0 : 1;
+    return write_all(fd, &status, 1);
+}
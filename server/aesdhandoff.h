@@ -0,0 +1,90 @@
+/*
+ * aesdhandoff.h
+ *
+ * Restarting aesdsocket without closing its listening socket.
+ *
+ * A listener can be inherited from systemd socket activation, or from a
+ * running aesdsocket which hands its listener, open data files and idle
+ * subscriber connections to its replacement over a Unix control socket,
+ * then finishes its other open connections and exits. Packets those
+ * connections complete are forwarded to the replacement to be committed,
+ * so they still reach the subscribers it took over.
+ */
+
+#ifndef AESDHANDOFF_H
+#define AESDHANDOFF_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define AESDHANDOFF_NAME_MAX 64
+
+enum aesdhandoff_type {
+    AESDHANDOFF_LISTENER = 1,   // The listening socket
+    AESDHANDOFF_STREAM,         // A stream's data file, name set
+    AESDHANDOFF_END,            // No descriptor, everything has been sent
+    AESDHANDOFF_SUBSCRIBER,     // A subscribed client connection, name set to its stream
+    AESDHANDOFF_FORWARD,        // Socket the old process forwards its remaining packets on
+};
+
+/**
+ * @return the listening socket passed by systemd socket activation, or -1
+ *   if this process was not socket activated. Clears the LISTEN_* variables.
+ */
+int aesdhandoff_activated_listener(void);
+
+/**
+ * Create the control socket at @param path, replacing a stale one.
+ * @return the listening control socket, or -1 on error
+ */
+int aesdhandoff_listen(const char* path);
+
+/**
+ * Send one descriptor to the process taking over, on the connection
+ * accepted from the control socket.
+ * @param type one of enum aesdhandoff_type
+ * @param name stream name for AESDHANDOFF_STREAM and AESDHANDOFF_SUBSCRIBER, otherwise NULL
+ * @param fd descriptor to pass, ignored for AESDHANDOFF_END
+ * @return 0 on success, -1 on error
+ */
+int aesdhandoff_send(int conn, int type, const char* name, int fd);
+
+/**
+ * Called for each descriptor received by aesdhandoff_take_over().
+ * @return 0 to continue, -1 to abort the takeover
+ */
+typedef int (*aesdhandoff_cb)(int type, const char* name, int fd, void* ctx);
+
+/**
+ * Ask the process listening on the control socket at @param path to hand
+ * over its descriptors, passing each to @param cb. Returns once the old
+ * process has sent everything and closed the connection, after which it no
+ * longer accepts connections and @param path may be reused.
+ * @return 0 on success, -1 if no process answered or the handoff failed
+ */
+int aesdhandoff_take_over(const char* path, aesdhandoff_cb cb, void* ctx);
+
+/**
+ * Send a packet for stream @param name to the replacement over the
+ * AESDHANDOFF_FORWARD socket @param fd and wait for it to be committed.
+ * Callers must not forward on the same socket concurrently.
+ * @return 0 if the replacement committed it, -1 if it failed to, or -2 if
+ *   the replacement has gone away and the packet was not committed
+ */
+int aesdhandoff_forward(int fd, const char* name, const char* data, size_t len);
+
+/**
+ * Receive one forwarded packet on @param fd. @param name must hold
+ * AESDHANDOFF_NAME_MAX + 1 bytes; *@param data is allocated with malloc().
+ * Reply with aesdhandoff_forward_done() once it has been committed.
+ * @return 1 on a packet, 0 once the old process has closed the socket, -1 on error
+ */
+int aesdhandoff_forward_recv(int fd, char* name, char** data, size_t* len);
+
+/**
+ * Tell the old process the outcome of committing its packet, @param rc 0 or -1.
+ * @return 0 on success, -1 on error
+ */
+int aesdhandoff_forward_done(int fd, int rc);
+
+#endif /* AESDHANDOFF_H */
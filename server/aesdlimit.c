@@ -0,0 +1,220 @@
+/*
+ * aesdlimit.c
+ *
+ * Timeouts use a hashed timer wheel with one-second slots. Connections only
+ * store their last activity time when data arrives; when a slot comes due
+ * each entry's real deadline is recomputed and the entry is either expired
+ * or moved to the slot of its new deadline. Rate limiting keeps a token
+ * bucket per source address in a small hash table owned by the accepting
+ * thread.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#include "aesdlimit.h"
+
+#define WHEEL_SLOTS 64              // One second per slot
+#define NO_SLOT ((unsigned int)-1)
+#define BUCKET_HASH_SIZE 1024
+#define BUCKET_PRUNE_INTERVAL_MS 10000
+
+typedef struct bucket {
+    struct bucket* next;
+    sa_family_t family;
+    uint8_t addr[16];
+    double tokens;
+    uint64_t last_ms;
+} bucket_t;
+
+static struct aesdlimit_config limits;
+static atomic_uint active_conns = 0;
+
+static LIST_HEAD(timer_list, aesdlimit_timer) wheel[WHEEL_SLOTS];
+static pthread_mutex_t wheel_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t wheel_tick;         // Last slot time processed, in seconds
+
+static bucket_t* buckets[BUCKET_HASH_SIZE];
+static uint64_t last_prune_ms;
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void aesdlimit_init(const struct aesdlimit_config* config) {
+    limits = *config;
+    for (int i = 0; i < WHEEL_SLOTS; i++) {
+        LIST_INIT(&wheel[i]);
+    }
+    wheel_tick = now_ms() / 1000;
+    last_prune_ms = now_ms();
+}
+
+// Drop buckets that have refilled completely, they behave the same as no bucket
+static void prune_buckets(uint64_t now) {
+    for (int i = 0; i < BUCKET_HASH_SIZE; i++) {
+        bucket_t** link = &buckets[i];
+        while (*link) {
+            bucket_t* b = *link;
+            if (b->tokens + (now - b->last_ms) / 1000.0 * limits.rate >= limits.burst) {
+                *link = b->next;
+                free(b);
+            } else {
+                link = &b->next;
+            }
+        }
+    }
+    last_prune_ms = now;
+}
+
+// Take one token from the bucket for @param addr
+// @return false if the bucket is empty
+static bool take_token(const struct sockaddr_storage* addr) {
+    uint8_t key[16] = {0};
+    size_t key_len;
+
+    if (addr->ss_family == AF_INET) {
+        key_len = sizeof(struct in_addr);
+        memcpy(key, &((const struct sockaddr_in*)addr)->sin_addr, key_len);
+    } else {
+        key_len = sizeof(struct in6_addr);
+        memcpy(key, &((const struct sockaddr_in6*)addr)->sin6_addr, key_len);
+    }
+
+    // FNV-1a over the address bytes
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < key_len; i++) {
+        hash = (hash ^ key[i]) * 16777619u;
+    }
+
+    uint64_t now = now_ms();
+    if (now - last_prune_ms >= BUCKET_PRUNE_INTERVAL_MS) {
+        prune_buckets(now);
+    }
+
+    bucket_t* b;
+    for (b = buckets[hash % BUCKET_HASH_SIZE]; b != NULL; b = b->next) {
+        if (b->family == addr->ss_family && memcmp(b->addr, key, sizeof(key)) == 0) break;
+    }
+    if (!b) {
+        b = malloc(sizeof(bucket_t));
+        if (!b) return true;  // Fail open, the connection cap still applies
+        b->family = addr->ss_family;
+        memcpy(b->addr, key, sizeof(key));
+        b->tokens = limits.burst;
+        b->last_ms = now;
+        b->next = buckets[hash % BUCKET_HASH_SIZE];
+        buckets[hash % BUCKET_HASH_SIZE] = b;
+    }
+
+    b->tokens += (now - b->last_ms) / 1000.0 * limits.rate;
+    if (b->tokens > limits.burst) b->tokens = limits.burst;
+    b->last_ms = now;
+    if (b->tokens < 1.0) return false;
+    b->tokens -= 1.0;
+    return true;
+}
+
+bool aesdlimit_admit(const struct sockaddr_storage* addr) {
+    // Checked and incremented from the accepting thread only, so no CAS loop is needed
+    if (limits.max_conns && atomic_load(&active_conns) >= limits.max_conns) return false;
+    if (limits.rate > 0 && !take_token(addr)) return false;
+    atomic_fetch_add(&active_conns, 1);
+    return true;
+}
+
+void aesdlimit_add(void) {
+    atomic_fetch_add(&active_conns, 1);
+}
+
+void aesdlimit_release(void) {
+    atomic_fetch_sub(&active_conns, 1);
+}
+
+// @return when the connection should be closed, in CLOCK_MONOTONIC ms, or UINT64_MAX for never
+static uint64_t timer_deadline(struct aesdlimit_timer* timer) {
+    uint64_t deadline = UINT64_MAX;
+
+    if (limits.idle_timeout_s) {
+        deadline = atomic_load_explicit(&timer->last_ms, memory_order_relaxed) + limits.idle_timeout_s * 1000ull;
+    }
+    if (limits.read_deadline_s) {
+        uint64_t read_deadline = timer->start_ms + limits.read_deadline_s * 1000ull;
+        if (read_deadline < deadline) deadline = read_deadline;
+    }
+    return deadline;
+}
+
+// Place @param timer in the slot that comes due at or after @param deadline. Caller holds wheel_mutex.
+static void wheel_insert(struct aesdlimit_timer* timer, uint64_t deadline) {
+    timer->slot = ((deadline + 999) / 1000) % WHEEL_SLOTS;
+    LIST_INSERT_HEAD(&wheel[timer->slot], timer, entries);
+}
+
+void aesdlimit_timer_add(struct aesdlimit_timer* timer, int fd) {
+    uint64_t now = now_ms();
+
+    timer->fd = fd;
+    timer->start_ms = now;
+    atomic_init(&timer->last_ms, now);
+    atomic_init(&timer->expired, false);
+    timer->slot = NO_SLOT;
+
+    uint64_t deadline = timer_deadline(timer);
+    if (deadline == UINT64_MAX) return;
+    pthread_mutex_lock(&wheel_mutex);
+    wheel_insert(timer, deadline);
+    pthread_mutex_unlock(&wheel_mutex);
+}
+
+void aesdlimit_timer_touch(struct aesdlimit_timer* timer) {
+    atomic_store_explicit(&timer->last_ms, now_ms(), memory_order_relaxed);
+}
+
+void aesdlimit_timer_del(struct aesdlimit_timer* timer) {
+    pthread_mutex_lock(&wheel_mutex);
+    if (timer->slot != NO_SLOT) {
+        LIST_REMOVE(timer, entries);
+        timer->slot = NO_SLOT;
+    }
+    pthread_mutex_unlock(&wheel_mutex);
+}
+
+void aesdlimit_tick(void) {
+    uint64_t now = now_ms();
+    uint64_t now_tick = now / 1000;
+
+    pthread_mutex_lock(&wheel_mutex);
+    // After a long stall one full revolution visits every slot
+    if (now_tick - wheel_tick > WHEEL_SLOTS) wheel_tick = now_tick - WHEEL_SLOTS;
+
+    for (; wheel_tick < now_tick; wheel_tick++) {
+        unsigned int slot = (wheel_tick + 1) % WHEEL_SLOTS;
+        struct aesdlimit_timer* timer = LIST_FIRST(&wheel[slot]);
+        while (timer != NULL) {
+            struct aesdlimit_timer* next = LIST_NEXT(timer, entries);
+            uint64_t deadline = timer_deadline(timer);
+
+            if (deadline <= now) {
+                // Wake the connection's blocked recv(); its thread sees expired and cleans up
+                LIST_REMOVE(timer, entries);
+                timer->slot = NO_SLOT;
+                atomic_store(&timer->expired, true);
+                shutdown(timer->fd, SHUT_RDWR);
+            } else if (deadline == UINT64_MAX) {
+                LIST_REMOVE(timer, entries);
+                timer->slot = NO_SLOT;
+            } else if (((deadline + 999) / 1000) % WHEEL_SLOTS != slot) {
+                LIST_REMOVE(timer, entries);
+                wheel_insert(timer, deadline);
+            }
+            timer = next;
+        }
+    }
+    pthread_mutex_unlock(&wheel_mutex);
+}
@@ -0,0 +1,88 @@
+/*
+ * aesdlimit.h
+ *
+ * Connection admission control for aesdsocket: a cap on concurrent
+ * connections, a token-bucket rate limit on new connections per source
+ * address, and idle/read-deadline timeouts kept in a single timer wheel.
+ */
+
+#ifndef AESDLIMIT_H
+#define AESDLIMIT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/queue.h>
+#include <sys/socket.h>
+
+struct aesdlimit_config {
+    unsigned int max_conns;         // Concurrent connections, 0 for no limit
+    unsigned int idle_timeout_s;    // Close after this long without data, 0 to disable
+    unsigned int read_deadline_s;   // Close if no full packet arrived by then, 0 to disable
+    double rate;                    // New connections per second per address, 0 for no limit
+    unsigned int burst;             // Token bucket depth for rate
+};
+
+/**
+ * A connection tracked by the timer wheel. Owned by the connection's thread,
+ * which must remove it with aesdlimit_timer_del() before freeing it.
+ */
+struct aesdlimit_timer {
+    int fd;
+    uint64_t start_ms;              // When the connection was accepted
+    atomic_uint_fast64_t last_ms;   // Last time data arrived
+    atomic_bool expired;            // Set when the wheel shut the connection down
+    unsigned int slot;
+    LIST_ENTRY(aesdlimit_timer) entries;
+};
+
+/**
+ * Set the limits. Call once before the server starts accepting.
+ */
+void aesdlimit_init(const struct aesdlimit_config* config);
+
+/**
+ * Decide whether to serve a new connection from @param addr.
+ * Only called from the accepting thread.
+ * @return true if the connection was admitted, in which case
+ *   aesdlimit_release() must be called when it closes.
+ */
+bool aesdlimit_admit(const struct sockaddr_storage* addr);
+
+/**
+ * Count a connection accepted elsewhere, such as one handed over by the
+ * server being replaced, without applying the limits.
+ * aesdlimit_release() must be called when it closes.
+ */
+void aesdlimit_add(void);
+
+/**
+ * Release the slot of a connection admitted by aesdlimit_admit() or
+ * counted by aesdlimit_add().
+ */
+void aesdlimit_release(void);
+
+/**
+ * Start tracking timeouts for the connection on @param fd.
+ */
+void aesdlimit_timer_add(struct aesdlimit_timer* timer, int fd);
+
+/**
+ * Record activity on a connection. Only an atomic store, the wheel
+ * picks up the new deadline lazily when the old one comes due.
+ */
+void aesdlimit_timer_touch(struct aesdlimit_timer* timer);
+
+/**
+ * Stop tracking a connection, once a full packet has arrived or it closed.
+ * Sending to the client is not limited by the timeouts.
+ */
+void aesdlimit_timer_del(struct aesdlimit_timer* timer);
+
+/**
+ * Advance the wheel to the current time, shutting down connections whose
+ * deadline has passed. Call periodically, at least once a second.
+ */
+void aesdlimit_tick(void);
+
+#endif /* AESDLIMIT_H */
@@ -0,0 +1,212 @@
+/*
+ * aesdlog.c
+ *
+ * Per-thread single-producer/single-consumer rings drained by one background
+ * thread. The producer side never takes a lock: if its ring is full the
+ * message is counted as dropped and reported later.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aesdlog.h"
+
+#define AESDLOG_RING_SLOTS 128      // Per-thread ring size, must be a power of two
+#define AESDLOG_MSG_MAX 184         // Longer messages are truncated
+#define AESDLOG_DRAIN_INTERVAL_US 20000
+#define AESDLOG_MAX_PER_SEC 500     // syslog lines emitted per second before suppressing
+
+typedef struct aesdlog_record {
+    int level;
+    char msg[AESDLOG_MSG_MAX];
+} aesdlog_record_t;
+
+typedef struct aesdlog_ring {
+    atomic_size_t head;             // Next slot the owning thread writes
+    atomic_size_t tail;             // Next slot the drain thread reads
+    atomic_uint dropped;            // Messages lost because the ring was full
+    atomic_bool orphaned;           // Owning thread exited, free once drained
+    struct aesdlog_ring* next;
+    aesdlog_record_t slots[AESDLOG_RING_SLOTS];
+} aesdlog_ring_t;
+
+atomic_int aesdlog_level = LOG_INFO;
+
+static atomic_bool running = false;
+static pthread_t drain_tid;
+
+// Registered rings; the list is only touched when threads start or exit, and by the drain thread
+static aesdlog_ring_t* rings = NULL;
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static __thread aesdlog_ring_t* thread_ring = NULL;
+
+// Drain thread state for coalescing and rate limiting
+static aesdlog_record_t last;
+static unsigned int last_repeats = 0;
+static time_t window_start = 0;
+static unsigned int window_count = 0;
+static unsigned int suppressed = 0;
+
+void aesdlog_set_level(int level) {
+    atomic_store(&aesdlog_level, level);
+}
+
+// Called when a thread with a ring exits; the drain thread frees the ring
+static void ring_release(void* arg) {
+    aesdlog_ring_t* ring = arg;
+    atomic_store_explicit(&ring->orphaned, true, memory_order_release);
+}
+
+static void ring_key_create(void) {
+    pthread_key_create(&ring_key, ring_release);
+}
+
+static aesdlog_ring_t* get_thread_ring(void) {
+    if (thread_ring) return thread_ring;
+
+    pthread_once(&ring_key_once, ring_key_create);
+    aesdlog_ring_t* ring = calloc(1, sizeof(aesdlog_ring_t));
+    if (!ring) return NULL;
+    pthread_setspecific(ring_key, ring);
+
+    pthread_mutex_lock(&rings_mutex);
+    ring->next = rings;
+    rings = ring;
+    pthread_mutex_unlock(&rings_mutex);
+
+    thread_ring = ring;
+    return ring;
+}
+
+void aesdlog_write(int level, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+
+    aesdlog_ring_t* ring = atomic_load_explicit(&running, memory_order_acquire) ? get_thread_ring() : NULL;
+    if (!ring) {
+        vsyslog(level, fmt, args);
+        va_end(args);
+        return;
+    }
+
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail >= AESDLOG_RING_SLOTS) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        va_end(args);
+        return;
+    }
+
+    aesdlog_record_t* rec = &ring->slots[head & (AESDLOG_RING_SLOTS - 1)];
+    rec->level = level;
+    vsnprintf(rec->msg, sizeof(rec->msg), fmt, args);
+    va_end(args);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// Report how many times the previous message was coalesced
+static void flush_repeats(void) {
+    if (last_repeats > 0) {
+        syslog(last.level, "last message repeated %u times", last_repeats);
+        last_repeats = 0;
+    }
+}
+
+// Emit one drained message, coalescing repeats and enforcing the per-second cap
+static void emit(const aesdlog_record_t* rec) {
+    if (last.msg[0] != '\0' && rec->level == last.level && strcmp(rec->msg, last.msg) == 0) {
+        last_repeats++;
+        return;
+    }
+    flush_repeats();
+    last = *rec;
+
+    time_t now = time(NULL);
+    if (now != window_start) {
+        if (suppressed > 0) {
+            syslog(LOG_WARNING, "%u log messages suppressed by rate limit", suppressed);
+            suppressed = 0;
+        }
+        window_start = now;
+        window_count = 0;
+    }
+    if (window_count >= AESDLOG_MAX_PER_SEC) {
+        suppressed++;
+        return;
+    }
+    window_count++;
+    syslog(rec->level, "%s", rec->msg);
+}
+
+// Drain every ring once, freeing rings whose threads have exited
+// @return the number of messages drained
+static size_t drain_all(void) {
+    size_t drained = 0;
+
+    pthread_mutex_lock(&rings_mutex);
+    aesdlog_ring_t** link = &rings;
+    while (*link) {
+        aesdlog_ring_t* ring = *link;
+        bool orphaned = atomic_load_explicit(&ring->orphaned, memory_order_acquire);
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+        for (; tail != head; tail++, drained++) {
+            emit(&ring->slots[tail & (AESDLOG_RING_SLOTS - 1)]);
+        }
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+        unsigned int dropped = atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
+        if (dropped > 0) {
+            flush_repeats();
+            syslog(LOG_WARNING, "%u log messages dropped, thread log buffer full", dropped);
+        }
+
+        if (orphaned) {
+            *link = ring->next;
+            free(ring);
+        } else {
+            link = &ring->next;
+        }
+    }
+    pthread_mutex_unlock(&rings_mutex);
+    return drained;
+}
+
+static void* drain_thread_func(void* arg) {
+    (void)arg;
+    while (atomic_load(&running)) {
+        // Report coalesced repeats once the burst of identical messages is over
+        if (drain_all() == 0) flush_repeats();
+        usleep(AESDLOG_DRAIN_INTERVAL_US);
+    }
+    return NULL;
+}
+
+int aesdlog_start(void) {
+    atomic_store(&running, true);
+    if (pthread_create(&drain_tid, NULL, drain_thread_func, NULL) != 0) {
+        atomic_store(&running, false);
+        return -1;
+    }
+    return 0;
+}
+
+void aesdlog_stop(void) {
+    if (!atomic_exchange(&running, false)) return;
+    pthread_join(drain_tid, NULL);
+    drain_all();
+    flush_repeats();
+    if (suppressed > 0) {
+        syslog(LOG_WARNING, "%u log messages suppressed by rate limit", suppressed);
+        suppressed = 0;
+    }
+}
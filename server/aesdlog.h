@@ -0,0 +1,62 @@
+/*
+ * aesdlog.h
+ *
+ * Asynchronous, rate-limited logging for aesdsocket.
+ *
+ * Each thread formats its messages into its own lock-free ring buffer and a
+ * background thread drains all rings to syslog. Messages below the runtime
+ * level are discarded before any formatting is done, and messages above
+ * AESDLOG_COMPILE_LEVEL are removed by the compiler. Consecutive identical
+ * messages are coalesced and syslog output is capped per second.
+ */
+
+#ifndef AESDLOG_H
+#define AESDLOG_H
+
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <syslog.h>
+
+// Messages with a priority numerically above this are compiled out
+#ifndef AESDLOG_COMPILE_LEVEL
+#define AESDLOG_COMPILE_LEVEL LOG_DEBUG
+#endif
+
+// Runtime threshold, messages with a priority numerically above it are dropped
+extern atomic_int aesdlog_level;
+
+#define AESDLOG(level, ...) do { \
+        if ((level) <= AESDLOG_COMPILE_LEVEL && \
+            (level) <= atomic_load_explicit(&aesdlog_level, memory_order_relaxed)) \
+            aesdlog_write((level), __VA_ARGS__); \
+    } while (0)
+
+#define AESDLOG_ERR(...)   AESDLOG(LOG_ERR, __VA_ARGS__)
+#define AESDLOG_INFO(...)  AESDLOG(LOG_INFO, __VA_ARGS__)
+#define AESDLOG_DEBUG(...) AESDLOG(LOG_DEBUG, __VA_ARGS__)
+
+/**
+ * Set the runtime level, one of the syslog LOG_* priorities.
+ */
+void aesdlog_set_level(int level);
+
+/**
+ * Start the background thread draining per-thread buffers to syslog.
+ * Until this is called, and after aesdlog_stop(), messages go straight to syslog.
+ * Must be called after any fork() done to daemonize.
+ * @return 0 on success, -1 if the thread could not be created.
+ */
+int aesdlog_start(void);
+
+/**
+ * Drain everything still buffered and stop the background thread.
+ */
+void aesdlog_stop(void);
+
+/**
+ * Queue a message for syslog. Use the AESDLOG_* macros instead so filtered
+ * messages cost only a compare.
+ */
+void aesdlog_write(int level, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#endif /* AESDLOG_H */
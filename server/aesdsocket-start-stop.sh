@@ -14,7 +14,7 @@ PID_FILE="/var/run/aesdsocket.pid"
 
 start() {
     echo "Starting aesdsocket..."
-    start-stop-daemon --start --quiet --background --make-pidfile --pidfile "$PID_FILE" --exec "$AESDSOCKET_PATH" -- -d
+    start-stop-daemon --start --quiet --pidfile "$PID_FILE" --exec "$AESDSOCKET_PATH" -- -d -p "$PID_FILE"
     if [ $? -eq 0 ]; then
         echo "aesdsocket started."
     else
@@ -38,6 +38,24 @@ stop() {
     fi
 }
 
+# Replace the running server without closing its listening socket: the new
+# instance takes over the listener and data files, and the old one finishes
+# its open connections and exits on its own.
+restart() {
+    if [ ! -f "$PID_FILE" ] || ! kill -0 "$(cat "$PID_FILE")" 2>/dev/null; then
+        start
+        return
+    fi
+    echo "Restarting aesdsocket..."
+    "$AESDSOCKET_PATH" -d -H -p "$PID_FILE"
+    if [ $? -eq 0 ]; then
+        echo "aesdsocket restarted."
+    else
+        echo "Failed to restart aesdsocket."
+        exit 1
+    fi
+}
+
 case "$1" in
     start)
         start
@@ -46,8 +64,7 @@ case "$1" in
         stop
         ;;
     restart)
-        stop
-        start
+        restart
         ;;
     *)
         echo "Usage: $0 {start|stop|restart}"
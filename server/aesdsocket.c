@@ -10,25 +10,61 @@
 #include <fcntl.h>
 #include <arpa/inet.h>
 #include <sys/time.h>   // For select()
+#include <poll.h>       // For checking the listener before a reserve accept
 #include <sys/stat.h>   // For mkdir()
 #include <errno.h>      // For error codes like EEXIST
 #include <pthread.h>    // NEW for multi-threading
 #include <time.h>       // NEW for timestamp and clock_gettime
 #include <sys/queue.h>  // NEW for linked-list (optional, but helpful)
+#include <stdatomic.h>  // Reference counts for packets shared between subscribers
+
+#include "aesdlog.h"
+#include "aesdtrace.h"
+#include "aesdlimit.h"
+#include "aesdhandoff.h"
 
 #define PORT "9000"
 #define BUFFER_SIZE 1024
 #define DATA_FILE "/var/tmp/aesdsocketdata"
 #define BACKLOG 10
+#define TRACE_FILE "/var/tmp/aesdsocket.trace"  // Flight recorder dump written on SIGUSR1
+#define CONTROL_SOCKET "/var/tmp/aesdsocket.handoff"  // A replacement started with -H connects here
+
+// Admission control defaults, see usage() for the options overriding them
+#define DEFAULT_MAX_CONNS 128
+#define DEFAULT_IDLE_TIMEOUT_S 60
+#define DEFAULT_RATE_BURST 10
+#define DEFAULT_MAX_PACKET (1024 * 1024)
+
+// A client whose first line is this command stays connected and is pushed
+// every packet committed after it subscribed, instead of a one-shot replay.
+#define SUBSCRIBE_CMD "AESDSOCKET_SUBSCRIBE\n"
+// Packets a subscriber may have queued before it is considered too slow and dropped
+#define SUBSCRIBER_MAX_QUEUED 1024
+
+// A client whose first line is this prefix followed by a name uses the named
+// stream, with its own data file DATA_FILE.<name>, instead of the default one.
+#define STREAM_CMD "AESDSOCKET_STREAM:"
+#define STREAM_NAME_MAX 64                  // Names are 1-64 characters of [A-Za-z0-9_-]
+#define STREAM_MAX 256                      // Streams one server will create
+#define STREAM_SHARDS 16                    // Independently locked registry shards
 
 int server_fd = -1, client_fd = -1;
+int control_fd = -1;                     // Listening control socket for handoff to a replacement
+int reserve_fd = -1;                     // Spare descriptor given up to shed a connection when out of them
+int forward_fd = -1;                     // Once handed off, where packets go for the replacement to commit
+pthread_mutex_t forward_mutex = PTHREAD_MUTEX_INITIALIZER;  // Protects forward_fd, one packet in flight at a time
+bool preserve_data = false;              // Keep existing data files, set when taking over from another server
 volatile sig_atomic_t stop = 0;
-
-pthread_mutex_t file_mutex; // Protects read/write to /var/tmp/aesdsocketdata
+volatile sig_atomic_t draining = 0;      // Handed off to a replacement: accept nothing new, finish open connections
+volatile sig_atomic_t dump_trace = 0;
+int listen_backlog = BACKLOG;
+size_t max_packet = DEFAULT_MAX_PACKET;  // Largest packet a client may send, 0 for no limit
 
 // Keep track of active threads using a singly-linked list:
 typedef struct thread_list_node {
     pthread_t thread_id;
+    atomic_bool complete;                 // Set by the thread when it is ready to be joined
     SLIST_ENTRY(thread_list_node) entries;
 } thread_list_node_t;
 
@@ -39,27 +75,99 @@ SLIST_HEAD(slisthead, thread_list_node) head = SLIST_HEAD_INITIALIZER(head);
 typedef struct client_params {
     int thread_client_fd;                 // The connection-specific socket fd
     struct sockaddr_storage client_addr;  // The client's address
+    thread_list_node_t* node;             // Entry in the thread list for this thread
+    struct aesdlimit_timer timer;         // Idle and read-deadline tracking
+    struct subscriber* subscribed;        // Set for a subscriber handed over by the previous server
 } client_params_t;
 
+// A committed packet. One copy is shared by reference between all subscribers
+// it is pushed to and freed when the last of them has sent it.
+typedef struct packet {
+    atomic_uint refcount;
+    size_t len;
+    char data[];
+} packet_t;
+
+// Per-subscriber queue entry pointing at a shared packet
+typedef struct packet_ref {
+    packet_t* packet;
+    STAILQ_ENTRY(packet_ref) entries;
+} packet_ref_t;
+
+typedef struct subscriber {
+    int fd;                                // The subscribed connection
+    struct stream* stream;
+    pthread_cond_t cond;                   // Signalled when a packet is queued or the subscriber is handed off
+    STAILQ_HEAD(, packet_ref) queue;       // Packets not yet sent to this subscriber
+    size_t queued;                         // Length of queue
+    bool busy;                             // Using the connection outside subscribers_mutex
+    bool overflowed;                       // Set when the subscriber fell too far behind
+    bool handed_off;                       // The connection now belongs to the replacement server
+    LIST_ENTRY(subscriber) entries;
+} subscriber_t;
+
+// A stream of packets with its own data file, lock and subscribers
+typedef struct stream {
+    char name[STREAM_NAME_MAX + 1];        // Empty for the default stream
+    char path[sizeof(DATA_FILE) + STREAM_NAME_MAX + 1];
+    int fd;                                // Data file, kept open O_APPEND while the server runs
+    pthread_mutex_t lock;                  // Serializes appends
+    pthread_mutex_t subscribers_mutex;     // Protects subscribers and their queues
+    pthread_cond_t subscribers_idle;       // While draining, signalled when a subscriber has sent its queue
+    LIST_HEAD(, subscriber) subscribers;
+    struct stream* next;                   // Next stream in the same registry shard
+} stream_t;
+
+// Streams are found by name in a registry split into shards with their own
+// locks, so looking up one stream never waits on clients of another.
+typedef struct stream_shard {
+    pthread_mutex_t lock;
+    stream_t* streams;
+} stream_shard_t;
+
+stream_shard_t stream_shards[STREAM_SHARDS];
+atomic_uint stream_count = 0;
+stream_t* default_stream = NULL;            // DATA_FILE, also receives the timestamps
+
+// Subscriber connections received while taking over, served once the server is set up
+typedef struct taken_subscriber {
+    int fd;
+    stream_t* stream;
+} taken_subscriber_t;
+
+taken_subscriber_t* taken_subscribers = NULL;
+size_t taken_count = 0;
+int taken_forward_fd = -1;                  // Packets still completed by the server we took over from
+
 // Signal handler to catch SIGINT and SIGTERM
 void handle_signal(int signo) {
     syslog(LOG_INFO, "Caught signal, exiting");
     stop = 1;
 }
 
+// Signal handler to catch SIGUSR1, the main loop then dumps the flight recorder
+void handle_dump_signal(int signo) {
+    dump_trace = 1;
+}
+
 // Function to clean up resources when shutting down
 void clean_up() {
     if (client_fd != -1) close(client_fd);
     if (server_fd != -1) close(server_fd);
+    if (control_fd != -1) {
+        close(control_fd);
+        unlink(CONTROL_SOCKET);
+    }
 
     // Remove the file only if a signal was received
     // For testing purposes, we have commented this out so that the file persists for validation.
     // if (stop) {
     //     remove(DATA_FILE);
-    //     syslog(LOG_INFO, "Removed file %s", DATA_FILE);
+    //     AESDLOG_INFO("Removed file %s", DATA_FILE);
     // }
 
-    syslog(LOG_INFO, "Cleaned up and exiting");
+    AESDLOG_INFO("Cleaned up and exiting");
+    aesdlog_stop();
     closelog();
 }
 
@@ -75,7 +183,7 @@ int setup_server_socket() {
     hints.ai_flags = AI_PASSIVE;
 
     if ((status = getaddrinfo(NULL, PORT, &hints, &servinfo)) != 0) {
-        syslog(LOG_ERR, "getaddrinfo error: %s", gai_strerror(status));
+        AESDLOG_ERR("getaddrinfo error: %s", gai_strerror(status));
         return -1;
     }
 
@@ -85,12 +193,12 @@ int setup_server_socket() {
             continue;
         }
         if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) == -1) {
-            syslog(LOG_ERR, "setsockopt error");
+            AESDLOG_ERR("setsockopt error");
             close(server_fd);
             return -1;
         }
         if (bind(server_fd, p->ai_addr, p->ai_addrlen) == -1) {
-            syslog(LOG_ERR, "Binding failed");
+            AESDLOG_ERR("Binding failed");
             close(server_fd);
             continue;
         }
@@ -98,15 +206,15 @@ int setup_server_socket() {
     }
 
     if (p == NULL) {
-        syslog(LOG_ERR, "Failed to bind socket");
+        AESDLOG_ERR("Failed to bind socket");
         freeaddrinfo(servinfo);
         return -1;
     }
 
     freeaddrinfo(servinfo);
 
-    if (listen(server_fd, BACKLOG) == -1) {
-        syslog(LOG_ERR, "Listening failed");
+    if (listen(server_fd, listen_backlog) == -1) {
+        AESDLOG_ERR("Listening failed");
         close(server_fd);
         return -1;
     }
@@ -120,20 +228,20 @@ void daemonize() {
 
     pid = fork();
     if (pid < 0) {
-        syslog(LOG_ERR, "Fork failed");
+        AESDLOG_ERR("Fork failed");
         exit(EXIT_FAILURE);
     }
     if (pid > 0) {
         exit(EXIT_SUCCESS);
     }
     if (setsid() < 0) {
-        syslog(LOG_ERR, "setsid failed");
+        AESDLOG_ERR("setsid failed");
         exit(EXIT_FAILURE);
     }
     signal(SIGHUP, SIG_IGN);
     pid = fork();
     if (pid < 0) {
-        syslog(LOG_ERR, "Fork failed");
+        AESDLOG_ERR("Fork failed");
         exit(EXIT_FAILURE);
     }
     if (pid > 0) {
@@ -141,6 +249,379 @@ void daemonize() {
     }
 }
 
+// Take a stream's lock, recording in the flight recorder how long we waited for it
+void stream_lock(stream_t* stream) {
+    uint64_t start = aesdtrace_now();
+    pthread_mutex_lock(&stream->lock);
+    AESDTRACE(AESDTRACE_LOCK_ACQUIRE, aesdtrace_now() - start);
+}
+
+void stream_unlock(stream_t* stream) {
+    pthread_mutex_unlock(&stream->lock);
+    AESDTRACE(AESDTRACE_LOCK_RELEASE, 0);
+}
+
+// @return true if @param name is usable as a stream name and data file suffix
+bool valid_stream_name(const char* name, size_t len) {
+    if (len == 0 || len > STREAM_NAME_MAX) return false;
+    for (size_t i = 0; i < len; i++) {
+        char c = name[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+              (c >= '0' && c <= '9') || c == '_' || c == '-')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Create a stream using data file @param fd, or opening its data file if fd is -1.
+// Files left by a previous run are truncated unless preserve_data is set.
+stream_t* stream_create(const char* name, size_t len, int fd) {
+    stream_t* stream = calloc(1, sizeof(stream_t));
+    if (!stream) return NULL;
+
+    memcpy(stream->name, name, len);
+    stream->name[len] = '\0';
+    if (len == 0) {
+        snprintf(stream->path, sizeof(stream->path), "%s", DATA_FILE);
+    } else {
+        snprintf(stream->path, sizeof(stream->path), "%s.%s", DATA_FILE, stream->name);
+    }
+    if (fd == -1) {
+        fd = open(stream->path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC | (preserve_data ? 0 : O_TRUNC), 0644);
+    }
+    if (fd == -1) {
+        free(stream);
+        return NULL;
+    }
+    stream->fd = fd;
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_mutex_init(&stream->subscribers_mutex, NULL);
+    pthread_cond_init(&stream->subscribers_idle, NULL);
+    LIST_INIT(&stream->subscribers);
+    return stream;
+}
+
+// Count one more stream unless STREAM_MAX already exist. Refusals leave the
+// count unchanged, so it never drifts past STREAM_MAX.
+// @return true if the caller may create a stream
+bool reserve_stream_slot(void) {
+    unsigned int count = atomic_load(&stream_count);
+    while (count < STREAM_MAX) {
+        if (atomic_compare_exchange_weak(&stream_count, &count, count + 1)) return true;
+    }
+    return false;
+}
+
+// Find the stream called @param name, creating it on first use with data
+// file @param fd, or its own data file if fd is -1
+// @return the stream, or NULL if it could not be created
+stream_t* get_stream_fd(const char* name, size_t len, int fd) {
+    // FNV-1a over the name picks the shard
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    }
+    stream_shard_t* shard = &stream_shards[hash % STREAM_SHARDS];
+
+    pthread_mutex_lock(&shard->lock);
+    stream_t* stream;
+    for (stream = shard->streams; stream != NULL; stream = stream->next) {
+        if (strlen(stream->name) == len && memcmp(stream->name, name, len) == 0) break;
+    }
+    if (!stream && reserve_stream_slot()) {
+        stream = stream_create(name, len, fd);
+        if (stream) {
+            stream->next = shard->streams;
+            shard->streams = stream;
+        } else {
+            atomic_fetch_sub(&stream_count, 1);
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return stream;
+}
+
+stream_t* get_stream(const char* name, size_t len) {
+    return get_stream_fd(name, len, -1);
+}
+
+void init_streams(void) {
+    for (int i = 0; i < STREAM_SHARDS; i++) {
+        pthread_mutex_init(&stream_shards[i].lock, NULL);
+        stream_shards[i].streams = NULL;
+    }
+}
+
+// Close every stream's data file. Only called once all client threads are joined.
+void close_streams(void) {
+    for (int i = 0; i < STREAM_SHARDS; i++) {
+        stream_t* stream = stream_shards[i].streams;
+        while (stream != NULL) {
+            stream_t* next = stream->next;
+            close(stream->fd);
+            pthread_mutex_destroy(&stream->lock);
+            pthread_mutex_destroy(&stream->subscribers_mutex);
+            pthread_cond_destroy(&stream->subscribers_idle);
+            free(stream);
+            stream = next;
+        }
+        stream_shards[i].streams = NULL;
+        pthread_mutex_destroy(&stream_shards[i].lock);
+    }
+    default_stream = NULL;
+}
+
+// Drop one reference to a packet, freeing it with the last one
+void packet_put(packet_t* packet) {
+    if (atomic_fetch_sub(&packet->refcount, 1) == 1) {
+        free(packet);
+    }
+}
+
+// Push a packet to every subscriber of a stream. A single copy is made and
+// each subscriber queue holds a reference to it. Caller holds the stream lock
+// so packets reach subscribers in the order they were committed.
+void publish_packet(stream_t* stream, const char* data, size_t len) {
+    pthread_mutex_lock(&stream->subscribers_mutex);
+    if (LIST_EMPTY(&stream->subscribers)) {
+        pthread_mutex_unlock(&stream->subscribers_mutex);
+        return;
+    }
+
+    packet_t* packet = malloc(sizeof(packet_t) + len);
+    if (!packet) {
+        AESDLOG_ERR("Malloc failed for published packet");
+        pthread_mutex_unlock(&stream->subscribers_mutex);
+        return;
+    }
+    atomic_init(&packet->refcount, 1);  // Held by this function until fan-out is done
+    packet->len = len;
+    memcpy(packet->data, data, len);
+
+    subscriber_t* sub;
+    LIST_FOREACH(sub, &stream->subscribers, entries) {
+        if (sub->overflowed) continue;
+        packet_ref_t* ref = malloc(sizeof(packet_ref_t));
+        if (!ref || sub->queued >= SUBSCRIBER_MAX_QUEUED) {
+            // Too slow or out of memory: disconnect rather than grow without bound
+            free(ref);
+            sub->overflowed = true;
+        } else {
+            atomic_fetch_add(&packet->refcount, 1);
+            ref->packet = packet;
+            STAILQ_INSERT_TAIL(&sub->queue, ref, entries);
+            sub->queued++;
+        }
+        pthread_cond_signal(&sub->cond);
+    }
+    pthread_mutex_unlock(&stream->subscribers_mutex);
+    packet_put(packet);
+}
+
+// Send a packet completed after the handoff to the replacement, which
+// commits it and publishes it to the subscribers it took over
+// @return 0 or -1 as commit_packet(), or -2 if it was not forwarded
+int forward_packet(stream_t* stream, const char* data, size_t len) {
+    int rc = -2;
+
+    pthread_mutex_lock(&forward_mutex);
+    if (forward_fd != -1) {
+        rc = aesdhandoff_forward(forward_fd, stream->name, data, len);
+        if (rc == -2) {
+            AESDLOG_ERR("Replacement stopped taking forwarded packets, committing them here");
+            close(forward_fd);
+            forward_fd = -1;
+        }
+    }
+    pthread_mutex_unlock(&forward_mutex);
+    return rc;
+}
+
+// Append a complete packet to a stream's data file and publish it to its subscribers
+int commit_packet(stream_t* stream, const char* data, size_t len) {
+    const char* p = data;
+    size_t left = len;
+    int rc = 0;
+
+    if (draining && (rc = forward_packet(stream, data, len)) != -2) {
+        return rc;
+    }
+    rc = 0;
+
+    AESDTRACE(AESDTRACE_APPEND_START, len);
+    stream_lock(stream);
+    while (left > 0) {
+        ssize_t written = write(stream->fd, p, left);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            rc = -1;
+            break;
+        }
+        p += written;
+        left -= written;
+    }
+    if (rc == 0) {
+        publish_packet(stream, data, len);
+    }
+    stream_unlock(stream);
+    AESDTRACE(AESDTRACE_APPEND_END, len);
+    return rc;
+}
+
+// Send the whole buffer, retrying on short writes
+int send_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t sent = send(fd, data, len, MSG_NOSIGNAL);
+        if (sent == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
+// Send the full contents of a stream's data file to the client
+int replay_data_file(stream_t* stream, int fd) {
+    char buffer[BUFFER_SIZE];
+    int rc = 0;
+
+    AESDTRACE(AESDTRACE_REPLAY_START, 0);
+    // The data file is only ever appended to, so everything committed so far
+    // can be read without holding the lock while the client drains it. The
+    // size comes from the file rather than a counter because a server we
+    // handed off to, or took over from, may be appending to it too.
+    struct stat st;
+    stream_lock(stream);
+    int stat_rc = fstat(stream->fd, &st);
+    stream_unlock(stream);
+    if (stat_rc == -1) {
+        AESDTRACE(AESDTRACE_REPLAY_END, 1);
+        return -1;
+    }
+    off_t size = st.st_size;
+
+    for (off_t offset = 0; offset < size; ) {
+        size_t want = size - offset < (off_t)sizeof(buffer) ? size - offset : sizeof(buffer);
+        ssize_t n = pread(stream->fd, buffer, want, offset);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0 || send_all(fd, buffer, n) == -1) {
+            rc = -1;
+            break;
+        }
+        offset += n;
+    }
+    AESDTRACE(AESDTRACE_REPLAY_END, rc == -1);
+    return rc;
+}
+
+// Mark a subscriber as no longer using its connection, waking a handoff
+// waiting for it if the queue is empty. Caller holds subscribers_mutex.
+void subscriber_idle(stream_t* stream, subscriber_t* sub) {
+    sub->busy = false;
+    if (draining && sub->queued == 0) {
+        pthread_cond_broadcast(&stream->subscribers_idle);
+    }
+}
+
+// Subscribe the connection @param fd to @param stream. Packets committed
+// from now on are queued for it until serve_subscriber() sends them.
+// @return the subscriber, or NULL if out of memory
+subscriber_t* subscriber_add(stream_t* stream, int fd) {
+    subscriber_t* sub = malloc(sizeof(subscriber_t));
+    if (!sub) return NULL;
+
+    sub->fd = fd;
+    sub->stream = stream;
+    pthread_cond_init(&sub->cond, NULL);
+    STAILQ_INIT(&sub->queue);
+    sub->queued = 0;
+    sub->busy = false;
+    sub->overflowed = false;
+    sub->handed_off = false;
+
+    pthread_mutex_lock(&stream->subscribers_mutex);
+    LIST_INSERT_HEAD(&stream->subscribers, sub, entries);
+    pthread_mutex_unlock(&stream->subscribers_mutex);
+    return sub;
+}
+
+// Unlink @param sub from its stream, unless hand_off_subscribers() already
+// did, and free it with any packets still queued for it.
+// Caller holds the stream's subscribers_mutex.
+void subscriber_remove(subscriber_t* sub) {
+    if (!sub->handed_off) {
+        LIST_REMOVE(sub, entries);
+    }
+    packet_ref_t* ref;
+    while ((ref = STAILQ_FIRST(&sub->queue)) != NULL) {
+        STAILQ_REMOVE_HEAD(&sub->queue, entries);
+        packet_put(ref->packet);
+        free(ref);
+    }
+    pthread_cond_destroy(&sub->cond);
+    free(sub);
+}
+
+// Keep a subscribed client connected and push it every newly committed packet
+// until it disconnects, falls behind, the server stops, or the connection is
+// handed to a replacement server. Frees @param sub.
+void serve_subscriber(subscriber_t* sub, const char* client_ip) {
+    stream_t* stream = sub->stream;
+    int fd = sub->fd;
+    char scratch[BUFFER_SIZE];
+
+    pthread_mutex_lock(&stream->subscribers_mutex);
+    while (!stop && !sub->overflowed && !sub->handed_off) {
+        packet_ref_t* ref = STAILQ_FIRST(&sub->queue);
+        if (!ref) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += 1;
+            if (pthread_cond_timedwait(&sub->cond, &stream->subscribers_mutex, &deadline) != ETIMEDOUT) {
+                continue;
+            }
+            // Nothing to push: check whether the peer has gone away. Anything
+            // the subscriber sends is discarded.
+            sub->busy = true;
+            pthread_mutex_unlock(&stream->subscribers_mutex);
+            ssize_t n = recv(fd, scratch, sizeof(scratch), MSG_DONTWAIT);
+            bool peer_closed = n == 0 || (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+            pthread_mutex_lock(&stream->subscribers_mutex);
+            subscriber_idle(stream, sub);
+            if (peer_closed) break;
+            continue;
+        }
+        STAILQ_REMOVE_HEAD(&sub->queue, entries);
+        sub->queued--;
+        sub->busy = true;
+        pthread_mutex_unlock(&stream->subscribers_mutex);
+
+        int rc = send_all(fd, ref->packet->data, ref->packet->len);
+        packet_put(ref->packet);
+        free(ref);
+
+        pthread_mutex_lock(&stream->subscribers_mutex);
+        subscriber_idle(stream, sub);
+        if (rc == -1) break;
+    }
+    bool overflowed = sub->overflowed;
+    bool handed_off = sub->handed_off;
+    subscriber_remove(sub);
+    pthread_mutex_unlock(&stream->subscribers_mutex);
+
+    if (overflowed) {
+        AESDLOG_ERR("Subscriber %s fell behind, disconnecting", client_ip);
+    }
+    if (handed_off) {
+        AESDLOG_INFO("Handed off subscriber %s", client_ip);
+    } else {
+        AESDLOG_INFO("Unsubscribed %s", client_ip);
+    }
+}
+
 // Helper function to append a timestamp to the data file
 void append_timestamp(void) {
     char time_str[100];
@@ -151,15 +632,9 @@ void append_timestamp(void) {
     timeinfo = localtime(&rawtime);
     strftime(time_str, sizeof(time_str), "timestamp:%a, %d %b %Y %H:%M:%S %z\n", timeinfo);
 
-    pthread_mutex_lock(&file_mutex);
-    FILE *fp = fopen(DATA_FILE, "a");
-    if (fp) {
-        fputs(time_str, fp);
-        fclose(fp);
-    } else {
-        syslog(LOG_ERR, "Failed to open file for timestamp append");
+    if (commit_packet(default_stream, time_str, strlen(time_str)) == -1) {
+        AESDLOG_ERR("Failed to open file for timestamp append");
     }
-    pthread_mutex_unlock(&file_mutex);
 }
 
 // Timer thread to append timestamps every 10 seconds using a polling loop on CLOCK_MONOTONIC
@@ -173,9 +648,13 @@ void* timer_thread_func(void* arg) {
     append_timestamp();
 
     while (!stop) {
+        // Close connections past their idle or read deadline
+        aesdlimit_tick();
+
         clock_gettime(CLOCK_MONOTONIC, &now);
-        // Check if at least 10 seconds have elapsed
-        if ((now.tv_sec - start.tv_sec) >= 10) {
+        // Check if at least 10 seconds have elapsed. Once handed off the
+        // replacement appends the timestamps.
+        if ((now.tv_sec - start.tv_sec) >= 10 && !draining) {
             append_timestamp();
             // Reset start to current time after appending a timestamp
             start = now;
@@ -188,6 +667,113 @@ void* timer_thread_func(void* arg) {
     return NULL;
 }
 
+// If the packet starts with a STREAM_CMD line, switch @param stream to the
+// stream it names and remove that line from the packet.
+// @return 0 on success, -1 if the name is invalid or the stream could not be created
+int select_stream(stream_t** stream, char* packet, size_t* packet_len) {
+    size_t prefix_len = strlen(STREAM_CMD);
+    if (*packet_len < prefix_len || memcmp(packet, STREAM_CMD, prefix_len) != 0) {
+        return 0;
+    }
+
+    char* eol = memchr(packet, '\n', *packet_len);
+    const char* name = packet + prefix_len;
+    size_t name_len = eol - name;
+    if (!valid_stream_name(name, name_len)) return -1;
+    if (!(*stream = get_stream(name, name_len))) return -1;
+
+    size_t line_len = eol + 1 - packet;
+    memmove(packet, eol + 1, *packet_len - line_len);
+    *packet_len -= line_len;
+    return 0;
+}
+
+// Receive one packet from a newly accepted client and commit and replay it,
+// or turn the connection into a subscription
+void serve_client(client_params_t* params, int local_fd, const char* client_ip) {
+    aesdlimit_timer_add(&params->timer, local_fd);
+
+    char buffer[BUFFER_SIZE];
+    ssize_t bytes_read;
+    int newline_triggered = 0;  // Flag to indicate if a newline was received
+    bool failed = false;        // The packet was abandoned and must not be committed
+    char* packet = NULL;        // Data received so far, committed as one packet
+    size_t packet_len = 0, packet_cap = 0;
+    stream_t* stream = default_stream;
+    bool header_checked = false;
+
+    // Repeatedly read data from the client until a full packet has arrived
+    while ((bytes_read = recv(local_fd, buffer, BUFFER_SIZE, 0)) > 0) {
+        AESDTRACE(AESDTRACE_RECV, bytes_read);
+        AESDLOG_DEBUG("Received %zd bytes from %s", bytes_read, client_ip);
+        aesdlimit_timer_touch(&params->timer);
+        if (max_packet && packet_len + bytes_read > max_packet) {
+            AESDLOG_ERR("Packet from %s exceeds %zu bytes, closing", client_ip, max_packet);
+            failed = true;
+            break;
+        }
+        if (packet_len + bytes_read > packet_cap) {
+            size_t new_cap = packet_cap ? packet_cap * 2 : BUFFER_SIZE;
+            while (new_cap < packet_len + bytes_read) new_cap *= 2;
+            char* grown = realloc(packet, new_cap);
+            if (!grown) {
+                AESDLOG_ERR("Realloc failed for packet from %s", client_ip);
+                failed = true;
+                break;
+            }
+            packet = grown;
+            packet_cap = new_cap;
+        }
+        memcpy(packet + packet_len, buffer, bytes_read);
+        packet_len += bytes_read;
+
+        if (!memchr(buffer, '\n', bytes_read)) continue;
+
+        // The first line may select a stream rather than be data
+        if (!header_checked) {
+            header_checked = true;
+            if (select_stream(&stream, packet, &packet_len) == -1) {
+                AESDLOG_ERR("Rejected stream selection from %s", client_ip);
+                failed = true;
+                break;
+            }
+            if (!memchr(packet, '\n', packet_len)) continue;
+        }
+        newline_triggered = 1;
+        break;
+    }
+    // Timeouts only cover waiting for the client, not committing the packet
+    // or replaying the file to it, however long that takes
+    aesdlimit_timer_del(&params->timer);
+
+    if (atomic_load(&params->timer.expired)) {
+        // Shut down by the timer wheel: drop the partial packet instead of committing it
+        AESDLOG_INFO("Timed out connection from %s", client_ip);
+    } else if (failed) {
+        // Already logged, close without committing or replaying
+    } else if (newline_triggered && packet_len == strlen(SUBSCRIBE_CMD) &&
+        memcmp(packet, SUBSCRIBE_CMD, packet_len) == 0) {
+        subscriber_t* sub = subscriber_add(stream, local_fd);
+        if (sub) {
+            AESDLOG_INFO("Subscribed %s", client_ip);
+            serve_subscriber(sub, client_ip);
+        } else {
+            AESDLOG_ERR("Malloc failed for subscriber %s", client_ip);
+        }
+    } else {
+        if (packet_len > 0 && commit_packet(stream, packet, packet_len) == -1) {
+            AESDLOG_ERR("Failed to append to file: %s", stream->path);
+        } else if (newline_triggered || bytes_read == 0) {
+            // Reply with the whole file once a newline arrives, or when the
+            // connection closed normally without one.
+            if (replay_data_file(stream, local_fd) == -1) {
+                AESDLOG_ERR("Failed to replay file: %s", stream->path);
+            }
+        }
+    }
+    free(packet);
+}
+
 // Thread function to handle each client's connection
 void* client_thread_func(void* arg) {
     client_params_t* params = (client_params_t*)arg;
@@ -202,64 +788,284 @@ void* client_thread_func(void* arg) {
         struct sockaddr_in6* s = (struct sockaddr_in6*)&params->client_addr;
         inet_ntop(AF_INET6, &s->sin6_addr, client_ip, sizeof client_ip);
     }
-    syslog(LOG_INFO, "Accepted connection from %s", client_ip);
+    if (params->subscribed) {
+        AESDLOG_INFO("Took over subscriber %s", client_ip);
+        serve_subscriber(params->subscribed, client_ip);
+    } else {
+        AESDLOG_INFO("Accepted connection from %s", client_ip);
+        serve_client(params, local_fd, client_ip);
+    }
 
-    char buffer[BUFFER_SIZE];
-    ssize_t bytes_read;
-    int newline_triggered = 0;  // Flag to indicate if a newline was received
+    AESDLOG_INFO("Closed connection from %s", client_ip);
+    AESDTRACE(AESDTRACE_CLOSE, local_fd);
+    close(local_fd);
+    aesdlimit_release();
+    atomic_store(&params->node->complete, true);
+    free(params);
+    pthread_exit(NULL);
+    return NULL;
+}
 
-    // Repeatedly read data from the client
-    while ((bytes_read = recv(local_fd, buffer, BUFFER_SIZE, 0)) > 0) {
-        syslog(LOG_INFO, "Received %zd bytes from %s", bytes_read, client_ip);
-        pthread_mutex_lock(&file_mutex);
-        FILE* data_file_ptr = fopen(DATA_FILE, "a");
-        if (!data_file_ptr) {
-            syslog(LOG_ERR, "Failed to open file for appending: %s", DATA_FILE);
-            pthread_mutex_unlock(&file_mutex);
-            break;
+// Commit the packets forwarded by the server we took over from, until it
+// has finished its connections and exited or we stop
+void* forward_thread_func(void* arg) {
+    (void)arg;
+    char name[AESDHANDOFF_NAME_MAX + 1];
+
+    while (!stop) {
+        struct pollfd pfd = { .fd = taken_forward_fd, .events = POLLIN };
+        int ready = poll(&pfd, 1, 1000);
+        if (ready == 0 || (ready == -1 && errno == EINTR)) continue;
+
+        char* data;
+        size_t len;
+        if (ready == -1 || aesdhandoff_forward_recv(taken_forward_fd, name, &data, &len) != 1) break;
+        stream_t* stream = NULL;
+        if (name[0] == '\0' || valid_stream_name(name, strlen(name))) {
+            stream = get_stream(name, strlen(name));
         }
-        fwrite(buffer, 1, bytes_read, data_file_ptr);
-        // No explicit fflush() here, to remain as close as possible to your working local version
-        fclose(data_file_ptr);
-        pthread_mutex_unlock(&file_mutex);
-
-        if (strchr(buffer, '\n')) {
-            newline_triggered = 1;
-            pthread_mutex_lock(&file_mutex);
-            data_file_ptr = fopen(DATA_FILE, "r");
-            if (!data_file_ptr) {
-                syslog(LOG_ERR, "Failed to open file for reading: %s", DATA_FILE);
-                pthread_mutex_unlock(&file_mutex);
-                break;
+        int rc = stream ? commit_packet(stream, data, len) : -1;
+        free(data);
+        if (aesdhandoff_forward_done(taken_forward_fd, rc) == -1) break;
+    }
+    close(taken_forward_fd);
+    taken_forward_fd = -1;
+    return NULL;
+}
+
+// Receive one descriptor from the server we are taking over from
+int take_over_cb(int type, const char* name, int fd, void* ctx) {
+    (void)ctx;
+    if (type == AESDHANDOFF_LISTENER && server_fd == -1) {
+        server_fd = fd;
+        return 0;
+    }
+    if (type == AESDHANDOFF_STREAM && (name[0] == '\0' || valid_stream_name(name, strlen(name)))) {
+        stream_t* stream = get_stream_fd(name, strlen(name), fd);
+        if (stream && stream->fd == fd) return 0;
+    }
+    if (type == AESDHANDOFF_FORWARD && taken_forward_fd == -1) {
+        taken_forward_fd = fd;
+        return 0;
+    }
+    if (type == AESDHANDOFF_SUBSCRIBER && (name[0] == '\0' || valid_stream_name(name, strlen(name)))) {
+        // The stream's data file was sent first, so this finds rather than creates it
+        stream_t* stream = get_stream(name, strlen(name));
+        taken_subscriber_t* grown = realloc(taken_subscribers, (taken_count + 1) * sizeof(*grown));
+        if (stream && grown) {
+            taken_subscribers = grown;
+            taken_subscribers[taken_count].fd = fd;
+            taken_subscribers[taken_count].stream = stream;
+            taken_count++;
+            return 0;
+        }
+        if (grown) taken_subscribers = grown;
+    }
+    AESDLOG_ERR("Unexpected descriptor in handoff");
+    return -1;
+}
+
+// Pass a stream's subscriber connections to the replacement. A subscriber is
+// only handed over between packets, so wait until @param deadline for those
+// still sending; any busy after that are disconnected so they can reconnect
+// to the replacement rather than wait on a server that gets no new packets.
+// @return 0 on success, -1 if a connection could not be sent
+int hand_off_subscribers(int conn, stream_t* stream, const struct timespec* deadline) {
+    int rc = 0;
+    bool expired = false;
+
+    pthread_mutex_lock(&stream->subscribers_mutex);
+    subscriber_t* sub = LIST_FIRST(&stream->subscribers);
+    while (sub != NULL && rc == 0) {
+        if (sub->overflowed) {
+            // Already leaving
+            sub = LIST_NEXT(sub, entries);
+        } else if ((sub->busy || sub->queued > 0) && !expired) {
+            // The list may change while waiting, so start over afterwards
+            if (pthread_cond_timedwait(&stream->subscribers_idle, &stream->subscribers_mutex, deadline) == ETIMEDOUT) {
+                expired = true;
             }
-            while (fgets(buffer, BUFFER_SIZE, data_file_ptr) != NULL) {
-                send(local_fd, buffer, strlen(buffer), 0);
+            sub = LIST_FIRST(&stream->subscribers);
+        } else if (sub->busy || sub->queued > 0) {
+            AESDLOG_ERR("Subscriber busy during handoff, disconnecting");
+            shutdown(sub->fd, SHUT_RDWR);
+            sub = LIST_NEXT(sub, entries);
+        } else {
+            rc = aesdhandoff_send(conn, AESDHANDOFF_SUBSCRIBER, stream->name, sub->fd);
+            if (rc == 0) {
+                subscriber_t* next = LIST_NEXT(sub, entries);
+                LIST_REMOVE(sub, entries);
+                sub->handed_off = true;
+                pthread_cond_signal(&sub->cond);
+                sub = next;
             }
-            fclose(data_file_ptr);
-            pthread_mutex_unlock(&file_mutex);
-            break; // done with this connection
-        }
-    }
-    // If connection closed normally and no newline was triggered, send the file contents now.
-    if (!newline_triggered && bytes_read == 0) {
-        pthread_mutex_lock(&file_mutex);
-        FILE* data_file_ptr = fopen(DATA_FILE, "r");
-        if (data_file_ptr) {
-            while (fgets(buffer, BUFFER_SIZE, data_file_ptr) != NULL) {
-                send(local_fd, buffer, strlen(buffer), 0);
+        }
+    }
+    pthread_mutex_unlock(&stream->subscribers_mutex);
+    return rc;
+}
+
+// A replacement connected to the control socket: give it our listener, the
+// stream data files and the subscriber connections, then stop accepting.
+// Other connections already open are finished before this process exits,
+// with the packets they complete forwarded to the replacement to commit.
+void hand_off(void) {
+    int conn = accept(control_fd, NULL, NULL);
+    if (conn == -1) return;
+
+    // The replacement opens the same data files, so streams this process
+    // creates from now on must not truncate them
+    preserve_data = true;
+    draining = 1;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 1;
+
+    int pair[2] = { -1, -1 };
+    int rc = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair);
+    if (rc == 0) rc = aesdhandoff_send(conn, AESDHANDOFF_LISTENER, NULL, server_fd);
+    for (int i = 0; i < STREAM_SHARDS && rc == 0; i++) {
+        pthread_mutex_lock(&stream_shards[i].lock);
+        for (stream_t* stream = stream_shards[i].streams; stream != NULL && rc == 0; stream = stream->next) {
+            rc = aesdhandoff_send(conn, AESDHANDOFF_STREAM, stream->name, stream->fd);
+        }
+        pthread_mutex_unlock(&stream_shards[i].lock);
+    }
+    // Forward packets before any subscriber moves, so none misses a packet
+    // completed by a connection still open here
+    if (rc == 0) rc = aesdhandoff_send(conn, AESDHANDOFF_FORWARD, NULL, pair[1]);
+    if (rc == 0) {
+        pthread_mutex_lock(&forward_mutex);
+        forward_fd = pair[0];
+        pthread_mutex_unlock(&forward_mutex);
+    } else if (pair[0] != -1) {
+        close(pair[0]);
+    }
+    if (pair[1] != -1) close(pair[1]);
+    for (int i = 0; i < STREAM_SHARDS && rc == 0; i++) {
+        pthread_mutex_lock(&stream_shards[i].lock);
+        for (stream_t* stream = stream_shards[i].streams; stream != NULL && rc == 0; stream = stream->next) {
+            rc = hand_off_subscribers(conn, stream, &deadline);
+        }
+        pthread_mutex_unlock(&stream_shards[i].lock);
+    }
+    if (rc == 0) rc = aesdhandoff_send(conn, AESDHANDOFF_END, NULL, -1);
+    if (rc == -1) {
+        AESDLOG_ERR("Handoff to replacement failed, continuing to serve");
+        draining = 0;
+        pthread_mutex_lock(&forward_mutex);
+        if (forward_fd != -1) close(forward_fd);
+        forward_fd = -1;
+        pthread_mutex_unlock(&forward_mutex);
+        close(conn);
+        return;
+    }
+
+    // Release the control socket path before the replacement sees us close the connection
+    close(control_fd);
+    control_fd = -1;
+    unlink(CONTROL_SOCKET);
+    close(server_fd);
+    server_fd = -1;
+    close(conn);
+    AESDLOG_INFO("Handed off listener to replacement, finishing open connections");
+}
+
+void usage(const char* prog) {
+    fprintf(stderr,
+            "Usage: %s [-d] [-v] [-H] [-p pidfile] [-c max_conns] [-i idle_s] [-t read_deadline_s]\n"
+            "          [-r conns_per_s] [-b burst] [-q backlog] [-m max_packet]\n"
+            "  -d  run as a daemon\n"
+            "  -H  take over the listener, data files and subscribers of the running server\n"
+            "  -p  write the server's pid to this file\n"
+            "  -v  enable debug logging\n"
+            "  -c  concurrent connections, 0 for no limit (default %d)\n"
+            "  -i  close connections idle this many seconds, 0 to disable (default %d)\n"
+            "  -t  close connections that have not sent a full packet within this many seconds (default off)\n"
+            "  -r  new connections per second per source address (default no limit)\n"
+            "  -b  burst of connections allowed above -r (default %d)\n"
+            "  -q  listen backlog (default %d)\n"
+            "  -m  largest packet in bytes, 0 for no limit (default %d)\n",
+            prog, DEFAULT_MAX_CONNS, DEFAULT_IDLE_TIMEOUT_S, DEFAULT_RATE_BURST, BACKLOG, DEFAULT_MAX_PACKET);
+}
+
+// Close a connection refused by admission control as cheaply as possible:
+// a zero linger time resets it instead of leaving it in TIME_WAIT.
+void shed_connection(int fd) {
+    struct linger lg = { .l_onoff = 1, .l_linger = 0 };
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    close(fd);
+}
+
+// Start a thread serving the connection @param fd from @param addr, as a
+// subscriber of @param subscribed if set, and add it to the thread list.
+// @return 0 on success, -1 if the thread could not be started
+int start_client_thread(int fd, const struct sockaddr_storage* addr, subscriber_t* subscribed) {
+    client_params_t* cparams = (client_params_t*)malloc(sizeof(client_params_t));
+    thread_list_node_t* node = malloc(sizeof(thread_list_node_t));
+    if (!cparams || !node) {
+        AESDLOG_ERR("Malloc failed for client thread");
+        free(cparams);
+        free(node);
+        return -1;
+    }
+    cparams->thread_client_fd = fd;
+    memcpy(&cparams->client_addr, addr, sizeof(*addr));
+    cparams->node = node;
+    cparams->subscribed = subscribed;
+    atomic_init(&node->complete, false);
+
+    if (pthread_create(&node->thread_id, NULL, client_thread_func, cparams) != 0) {
+        AESDLOG_ERR("Failed to create client thread");
+        free(cparams);
+        free(node);
+        return -1;
+    }
+    SLIST_INSERT_HEAD(&head, node, entries);
+    return 0;
+}
+
+// Recover from a failed accept(). The pending connection keeps the listener
+// readable, so when out of descriptors the reserve one is released to accept
+// and reset it, and when out of memory or descriptors even so we back off
+// briefly rather than spin on select() and accept().
+void accept_failed(int err) {
+    AESDLOG_ERR("Accept failed: %s", strerror(err));
+    if ((err == EMFILE || err == ENFILE) && reserve_fd != -1) {
+        close(reserve_fd);
+        struct pollfd pfd = { .fd = server_fd, .events = POLLIN };
+        if (poll(&pfd, 1, 0) == 1) {
+            int fd = accept(server_fd, NULL, NULL);
+            if (fd != -1) shed_connection(fd);
+        }
+        reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if (reserve_fd != -1) return;
+    }
+    if (err == EMFILE || err == ENFILE || err == ENOMEM || err == ENOBUFS) {
+        usleep(100000);
+    }
+}
+
+// Join client threads that have finished so the thread list does not grow without bound
+void reap_threads(void) {
+    thread_list_node_t* prev = NULL;
+    thread_list_node_t* curr = SLIST_FIRST(&head);
+    while (curr != NULL) {
+        thread_list_node_t* next = SLIST_NEXT(curr, entries);
+        if (atomic_load(&curr->complete)) {
+            pthread_join(curr->thread_id, NULL);
+            if (prev) {
+                SLIST_NEXT(prev, entries) = next;
+            } else {
+                SLIST_REMOVE_HEAD(&head, entries);
             }
-            fclose(data_file_ptr);
+            free(curr);
         } else {
-            syslog(LOG_ERR, "Failed to open file for reading (post-loop): %s", DATA_FILE);
+            prev = curr;
         }
-        pthread_mutex_unlock(&file_mutex);
+        curr = next;
     }
-
-    syslog(LOG_INFO, "Closed connection from %s", client_ip);
-    close(local_fd);
-    free(params);
-    pthread_exit(NULL);
-    return NULL;
 }
 
 int main(int argc, char* argv[]) {
@@ -274,92 +1080,224 @@ int main(int argc, char* argv[]) {
 
     // Ensure /var/tmp exists
     if (mkdir("/var/tmp", 0777) == -1 && errno != EEXIST) {
-        syslog(LOG_ERR, "Failed to create /var/tmp directory");
+        AESDLOG_ERR("Failed to create /var/tmp directory");
         exit(EXIT_FAILURE);
     }
 
-    // Remove the file before each run to ensure it's cleared
-    remove(DATA_FILE);
-    syslog(LOG_INFO, "Removed file %s before starting", DATA_FILE);
-
-    // Check for the -d argument to run in daemon mode
-    if (argc > 1 && strcmp(argv[1], "-d") == 0) {
-        daemon_mode = true;
+    struct aesdlimit_config limits = {
+        .max_conns = DEFAULT_MAX_CONNS,
+        .idle_timeout_s = DEFAULT_IDLE_TIMEOUT_S,
+        .read_deadline_s = 0,
+        .rate = 0,
+        .burst = DEFAULT_RATE_BURST,
+    };
+    bool take_over = false;
+    const char* pid_file = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "dvHp:c:i:t:r:b:q:m:")) != -1) {
+        switch (opt) {
+        case 'd':
+            daemon_mode = true;
+            break;
+        case 'H':
+            take_over = true;
+            break;
+        case 'p':
+            pid_file = optarg;
+            break;
+        case 'v':
+            aesdlog_set_level(LOG_DEBUG);
+            break;
+        case 'c':
+            limits.max_conns = strtoul(optarg, NULL, 10);
+            break;
+        case 'i':
+            limits.idle_timeout_s = strtoul(optarg, NULL, 10);
+            break;
+        case 't':
+            limits.read_deadline_s = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            limits.rate = strtod(optarg, NULL);
+            break;
+        case 'b':
+            limits.burst = strtoul(optarg, NULL, 10);
+            break;
+        case 'q':
+            listen_backlog = atoi(optarg);
+            break;
+        case 'm':
+            max_packet = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
     }
+    if (limits.rate > 0 && limits.burst < 1) limits.burst = 1;
+    aesdlimit_init(&limits);
 
     // Set up signal handling for graceful exit
     signal(SIGINT, handle_signal);
     signal(SIGTERM, handle_signal);
+    signal(SIGUSR1, handle_dump_signal);
+
+    init_streams();
+
+    // Use an already bound listener when one is passed to us, either by systemd
+    // socket activation or by the server we are replacing, and keep its data.
+    server_fd = aesdhandoff_activated_listener();
+    if (server_fd != -1) {
+        preserve_data = true;
+        AESDLOG_INFO("Using listener from socket activation");
+    } else if (take_over) {
+        preserve_data = true;
+        if (aesdhandoff_take_over(CONTROL_SOCKET, take_over_cb, NULL) == 0 && server_fd != -1) {
+            AESDLOG_INFO("Took over listener from running server");
+        } else {
+            // The old server keeps committing its own packets
+            if (taken_forward_fd != -1) close(taken_forward_fd);
+            taken_forward_fd = -1;
+            AESDLOG_ERR("No running server to take over, starting a new listener");
+        }
+    }
+
+    if (!preserve_data) {
+        // Remove the file before each run to ensure it's cleared
+        remove(DATA_FILE);
+        AESDLOG_INFO("Removed file %s before starting", DATA_FILE);
+    }
 
     // Setup server socket using getaddrinfo
-    if (setup_server_socket() == -1) {
-        syslog(LOG_ERR, "Failed to set up server socket");
+    if (server_fd == -1 && setup_server_socket() == -1) {
+        AESDLOG_ERR("Failed to set up server socket");
         exit(EXIT_FAILURE);
     }
 
+    control_fd = aesdhandoff_listen(CONTROL_SOCKET);
+    if (control_fd == -1) {
+        AESDLOG_ERR("Failed to create control socket %s, handoff disabled", CONTROL_SOCKET);
+    }
+
     // Run the program as a daemon if -d flag is provided
     if (daemon_mode) {
         daemonize();
-        syslog(LOG_INFO, "Running in daemon mode");
+        AESDLOG_INFO("Running in daemon mode");
+    }
+
+    if (pid_file) {
+        FILE* fp = fopen(pid_file, "w");
+        if (fp) {
+            fprintf(fp, "%d\n", getpid());
+            fclose(fp);
+        } else {
+            AESDLOG_ERR("Failed to write pid file %s", pid_file);
+        }
     }
 
-    // Initialize the file_mutex
-    pthread_mutex_init(&file_mutex, NULL);
+    // Hand logging off to the background thread now that we will not fork again
+    if (aesdlog_start() != 0) {
+        syslog(LOG_ERR, "Failed to start logging thread, logging synchronously");
+    }
+
+    // Open the default stream unless it was handed over; named streams are opened when first selected
+    default_stream = get_stream("", 0);
+    if (!default_stream) {
+        AESDLOG_ERR("Failed to open %s", DATA_FILE);
+        exit(EXIT_FAILURE);
+    }
+
+    reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+    // Resume pushing to the subscribers handed over with the listener. They
+    // are subscribed here, before anything can be committed, so none misses a packet.
+    for (size_t i = 0; i < taken_count; i++) {
+        struct sockaddr_storage peer_addr;
+        socklen_t peer_len = sizeof(peer_addr);
+        memset(&peer_addr, 0, sizeof(peer_addr));
+        getpeername(taken_subscribers[i].fd, (struct sockaddr*)&peer_addr, &peer_len);
+        subscriber_t* sub = subscriber_add(taken_subscribers[i].stream, taken_subscribers[i].fd);
+        aesdlimit_add();
+        if (!sub || start_client_thread(taken_subscribers[i].fd, &peer_addr, sub) == -1) {
+            if (sub) {
+                pthread_mutex_lock(&taken_subscribers[i].stream->subscribers_mutex);
+                subscriber_remove(sub);
+                pthread_mutex_unlock(&taken_subscribers[i].stream->subscribers_mutex);
+            }
+            aesdlimit_release();
+            close(taken_subscribers[i].fd);
+        }
+    }
+    free(taken_subscribers);
+    taken_subscribers = NULL;
+    taken_count = 0;
+
+    // Commit what the server we took over from forwards until it exits
+    pthread_t forward_tid;
+    bool forwarding = taken_forward_fd != -1 &&
+        pthread_create(&forward_tid, NULL, forward_thread_func, NULL) == 0;
 
     // Create the timer thread for timestamp appending
     pthread_t timer_tid;
     pthread_create(&timer_tid, NULL, timer_thread_func, NULL);
 
-    while (!stop) {
+    while (!stop && !draining) {
+        reap_threads();
+
+        if (dump_trace) {
+            dump_trace = 0;
+            long events = aesdtrace_dump(TRACE_FILE);
+            if (events == -1) {
+                AESDLOG_ERR("Failed to write flight recorder to %s", TRACE_FILE);
+            } else {
+                AESDLOG_INFO("Wrote %ld flight recorder events to %s", events, TRACE_FILE);
+            }
+        }
+
         FD_ZERO(&readfds);
         FD_SET(server_fd, &readfds);
+        if (control_fd != -1) FD_SET(control_fd, &readfds);
+        int max_fd = server_fd > control_fd ? server_fd : control_fd;
 
         // Timeout of 1 second
         tv.tv_sec = 1;
         tv.tv_usec = 0;
 
-        int ret = select(server_fd + 1, &readfds, NULL, NULL, &tv);
+        int ret = select(max_fd + 1, &readfds, NULL, NULL, &tv);
         if (ret == -1) {
-            syslog(LOG_ERR, "select error");
+            if (errno == EINTR) continue;  // Interrupted by a signal, recheck stop and dump_trace
+            AESDLOG_ERR("select error");
             break;
         } else if (ret == 0) {
             if (stop) break;
             continue;
         }
 
-        client_fd = accept(server_fd, (struct sockaddr*)&client_addr, &addr_len);
-        if (client_fd < 0) {
-            syslog(LOG_ERR, "Accept failed");
-            exit(EXIT_FAILURE);
+        if (control_fd != -1 && FD_ISSET(control_fd, &readfds)) {
+            hand_off();
+            continue;
         }
 
-        client_params_t* cparams = (client_params_t*)malloc(sizeof(client_params_t));
-        if (!cparams) {
-            syslog(LOG_ERR, "Malloc failed for client_params");
-            close(client_fd);
-            client_fd = -1;
+        addr_len = sizeof(client_addr);
+        client_fd = accept(server_fd, (struct sockaddr*)&client_addr, &addr_len);
+        if (client_fd < 0) {
+            // Out of descriptors or the peer gave up: keep serving the others
+            accept_failed(errno);
             continue;
         }
-        cparams->thread_client_fd = client_fd;
-        memcpy(&cparams->client_addr, &client_addr, sizeof(client_addr));
+        AESDTRACE(AESDTRACE_ACCEPT, client_fd);
 
-        pthread_t client_tid;
-        if (pthread_create(&client_tid, NULL, client_thread_func, cparams) != 0) {
-            syslog(LOG_ERR, "Failed to create client thread");
-            free(cparams);
-            close(client_fd);
+        if (!aesdlimit_admit(&client_addr)) {
+            AESDLOG_DEBUG("Shedding connection over admission limits");
+            shed_connection(client_fd);
             client_fd = -1;
             continue;
         }
 
-        thread_list_node_t* node = malloc(sizeof(thread_list_node_t));
-        if (!node) {
-            syslog(LOG_ERR, "Malloc failed for thread_list_node");
-        } else {
-            node->thread_id = client_tid;
-            SLIST_INSERT_HEAD(&head, node, entries);
+        if (start_client_thread(client_fd, &client_addr, NULL) == -1) {
+            aesdlimit_release();
+            shed_connection(client_fd);
         }
-
         client_fd = -1;
     }
 
@@ -368,8 +1306,7 @@ int main(int argc, char* argv[]) {
         server_fd = -1;
     }
 
-    pthread_join(timer_tid, NULL);
-
+    // The timer thread keeps enforcing idle timeouts while connections finish
     thread_list_node_t* curr = SLIST_FIRST(&head);
     while (curr != NULL) {
         thread_list_node_t* tmp = SLIST_NEXT(curr, entries);
@@ -378,7 +1315,11 @@ int main(int argc, char* argv[]) {
         curr = tmp;
     }
 
-    pthread_mutex_destroy(&file_mutex);
+    stop = 1;
+    pthread_join(timer_tid, NULL);
+    if (forwarding) pthread_join(forward_tid, NULL);
+
+    close_streams();
     clean_up();
     return 0;
 }
@@ -0,0 +1,154 @@
+/*
+ * aesdtrace.c
+ *
+ * Per-thread circular trace buffers. A buffer is handed to a thread the first
+ * time it records an event and returned to a free pool when the thread exits,
+ * so the next thread reuses it and memory stays bounded by the peak number of
+ * threads. Buffers are never freed, which lets a dump walk them while their
+ * owners keep recording.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "aesdtrace.h"
+
+#define AESDTRACE_EVENTS 4096       // Events kept per thread, must be a power of two
+
+typedef struct aesdtrace_buf {
+    atomic_uint_fast64_t head;      // Total events ever recorded into this buffer
+    atomic_bool in_use;             // Owned by a live thread
+    struct aesdtrace_buf* next;
+    struct aesdtrace_event events[AESDTRACE_EVENTS];
+} aesdtrace_buf_t;
+
+static aesdtrace_buf_t* buffers = NULL;
+static pthread_mutex_t buffers_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t buf_key;
+static pthread_once_t buf_key_once = PTHREAD_ONCE_INIT;
+static __thread aesdtrace_buf_t* thread_buf = NULL;
+static __thread uint32_t thread_tid = 0;
+
+uint64_t aesdtrace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Return an exiting thread's buffer to the pool, keeping its events for dumps
+static void buf_release(void* arg) {
+    aesdtrace_buf_t* buf = arg;
+    atomic_store_explicit(&buf->in_use, false, memory_order_release);
+}
+
+static void buf_key_create(void) {
+    pthread_key_create(&buf_key, buf_release);
+}
+
+static aesdtrace_buf_t* get_thread_buf(void) {
+    pthread_once(&buf_key_once, buf_key_create);
+
+    pthread_mutex_lock(&buffers_mutex);
+    aesdtrace_buf_t* buf;
+    for (buf = buffers; buf != NULL; buf = buf->next) {
+        if (!atomic_load_explicit(&buf->in_use, memory_order_acquire)) break;
+    }
+    if (!buf) {
+        buf = calloc(1, sizeof(aesdtrace_buf_t));
+        if (!buf) {
+            pthread_mutex_unlock(&buffers_mutex);
+            return NULL;
+        }
+        buf->next = buffers;
+        buffers = buf;
+    }
+    atomic_store_explicit(&buf->in_use, true, memory_order_relaxed);
+    pthread_mutex_unlock(&buffers_mutex);
+
+    pthread_setspecific(buf_key, buf);
+    thread_tid = (uint32_t)syscall(SYS_gettid);
+    thread_buf = buf;
+    return buf;
+}
+
+void aesdtrace_record(uint16_t type, uint64_t arg) {
+    aesdtrace_buf_t* buf = thread_buf;
+    if (!buf && !(buf = get_thread_buf())) return;
+
+    uint_fast64_t head = atomic_load_explicit(&buf->head, memory_order_relaxed);
+    struct aesdtrace_event* ev = &buf->events[head & (AESDTRACE_EVENTS - 1)];
+    ev->ts_ns = aesdtrace_now();
+    ev->arg = arg;
+    ev->tid = thread_tid;
+    ev->type = type;
+    ev->reserved = 0;
+    atomic_store_explicit(&buf->head, head + 1, memory_order_release);
+}
+
+// Copy the valid events of one buffer into @param out, oldest first
+// @return the number of events copied
+static size_t snapshot_buf(aesdtrace_buf_t* buf, struct aesdtrace_event* out) {
+    uint_fast64_t head = atomic_load_explicit(&buf->head, memory_order_acquire);
+    uint_fast64_t start = head > AESDTRACE_EVENTS ? head - AESDTRACE_EVENTS : 0;
+
+    for (uint_fast64_t i = start; i < head; i++) {
+        out[i - start] = buf->events[i & (AESDTRACE_EVENTS - 1)];
+    }
+    atomic_thread_fence(memory_order_acquire);
+
+    // The owner may have wrapped over the oldest slots while we copied; drop
+    // those, along with the slot it may be writing right now.
+    uint_fast64_t head_after = atomic_load_explicit(&buf->head, memory_order_relaxed);
+    uint_fast64_t valid = head_after + 1 > AESDTRACE_EVENTS ? head_after + 1 - AESDTRACE_EVENTS : 0;
+    if (valid <= start) return head - start;
+    if (valid >= head) return 0;
+    memmove(out, out + (valid - start), (head - valid) * sizeof(*out));
+    return head - valid;
+}
+
+long aesdtrace_dump(const char* path) {
+    struct aesdtrace_event* snapshot = malloc(sizeof(struct aesdtrace_event) * AESDTRACE_EVENTS);
+    if (!snapshot) return -1;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        free(snapshot);
+        return -1;
+    }
+
+    struct aesdtrace_header header;
+    memcpy(header.magic, AESDTRACE_MAGIC, sizeof(header.magic));
+    header.version = AESDTRACE_VERSION;
+    header.event_size = sizeof(struct aesdtrace_event);
+    header.event_count = 0;
+
+    bool ok = write(fd, &header, sizeof(header)) == sizeof(header);
+
+    pthread_mutex_lock(&buffers_mutex);
+    for (aesdtrace_buf_t* buf = buffers; ok && buf != NULL; buf = buf->next) {
+        size_t n = snapshot_buf(buf, snapshot);
+        ssize_t len = n * sizeof(*snapshot);
+        if (n > 0 && write(fd, snapshot, len) != len) {
+            ok = false;
+        }
+        header.event_count += n;
+    }
+    pthread_mutex_unlock(&buffers_mutex);
+
+    // Fill in the final count now that every buffer has been written
+    if (ok && pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+        ok = false;
+    }
+    close(fd);
+    free(snapshot);
+    return ok ? (long)header.event_count : -1;
+}
@@ -0,0 +1,75 @@
+/*
+ * aesdtrace.h
+ *
+ * Flight recorder for aesdsocket.
+ *
+ * Tracepoints write a fixed-size binary event into a circular buffer owned by
+ * the calling thread, so recording takes no locks and makes no system calls
+ * beyond reading CLOCK_MONOTONIC through the vDSO. The most recent events of
+ * every thread can be dumped to a file on request and converted to Chrome
+ * trace JSON with aesdtrace2json.py.
+ */
+
+#ifndef AESDTRACE_H
+#define AESDTRACE_H
+
+#include <stdint.h>
+
+#define AESDTRACE_MAGIC "AESDTRC1"
+#define AESDTRACE_VERSION 1
+
+enum aesdtrace_type {
+    AESDTRACE_ACCEPT = 1,       // arg: client fd
+    AESDTRACE_RECV,             // arg: bytes received
+    AESDTRACE_APPEND_START,     // arg: packet length
+    AESDTRACE_APPEND_END,       // arg: packet length
+    AESDTRACE_LOCK_ACQUIRE,     // A stream lock was taken, arg: nanoseconds spent waiting for it
+    AESDTRACE_LOCK_RELEASE,     // A stream lock was released, arg: unused
+    AESDTRACE_REPLAY_START,     // arg: unused
+    AESDTRACE_REPLAY_END,       // arg: 0 on success, 1 on failure
+    AESDTRACE_CLOSE,            // arg: client fd
+};
+
+// One recorded event, written to the dump file as is
+struct aesdtrace_event {
+    uint64_t ts_ns;             // CLOCK_MONOTONIC timestamp
+    uint64_t arg;
+    uint32_t tid;               // Kernel thread id of the recording thread
+    uint16_t type;              // enum aesdtrace_type
+    uint16_t reserved;
+};
+
+// Dump file header, followed by event_count struct aesdtrace_event records
+struct aesdtrace_header {
+    char magic[8];              // AESDTRACE_MAGIC, not NUL terminated
+    uint32_t version;
+    uint32_t event_size;
+    uint64_t event_count;
+};
+
+#ifdef AESDTRACE_DISABLE
+#define AESDTRACE(type, arg) do { } while (0)
+#else
+#define AESDTRACE(type, arg) aesdtrace_record((type), (arg))
+#endif
+
+/**
+ * @return the CLOCK_MONOTONIC time in nanoseconds, the clock used for events
+ */
+uint64_t aesdtrace_now(void);
+
+/**
+ * Record an event in the calling thread's trace buffer.
+ * Use AESDTRACE() so tracepoints can be compiled out.
+ */
+void aesdtrace_record(uint16_t type, uint64_t arg);
+
+/**
+ * Write the contents of all trace buffers to @param path.
+ * Safe to call while other threads keep recording; events overwritten
+ * during the copy are left out.
+ * @return the number of events written, or -1 on error
+ */
+long aesdtrace_dump(const char* path);
+
+#endif /* AESDTRACE_H */
@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+# Convert an aesdsocket flight recorder dump (written on SIGUSR1 to
+# /var/tmp/aesdsocket.trace) into Chrome trace JSON, viewable in
+# chrome://tracing or https://ui.perfetto.dev
+#
+# Usage: aesdtrace2json.py [dump] [output.json]
+
+import json
+import struct
+import sys
+
+HEADER = struct.Struct("<8sIIQ")
+EVENT = struct.Struct("<QQIHH")
+
+# Must match enum aesdtrace_type in aesdtrace.h
+ACCEPT, RECV, APPEND_START, APPEND_END, LOCK_ACQUIRE, LOCK_RELEASE, \
+    REPLAY_START, REPLAY_END, CLOSE = range(1, 10)
+
+INSTANT = {ACCEPT: ("accept", "fd"), RECV: ("recv", "bytes"), CLOSE: ("close", "fd")}
+BEGIN = {APPEND_START: ("append", "bytes"), REPLAY_START: ("replay", None)}
+END = {APPEND_END: "append", REPLAY_END: "replay"}
+
+
+def convert(data):
+    magic, version, event_size, count = HEADER.unpack_from(data, 0)
+    if magic != b"AESDTRC1" or version != 1 or event_size != EVENT.size:
+        raise ValueError("not an aesdsocket trace dump")
+
+    events = [EVENT.unpack_from(data, HEADER.size + i * event_size) for i in range(count)]
+    events.sort(key=lambda e: e[0])
+    base = events[0][0] if events else 0
+
+    out = []
+    for ts_ns, arg, tid, etype, _ in events:
+        ts = (ts_ns - base) / 1000.0
+        common = {"pid": 1, "tid": tid, "ts": ts}
+        if etype in INSTANT:
+            name, argname = INSTANT[etype]
+            out.append(dict(common, name=name, ph="i", s="t", args={argname: arg}))
+        elif etype in BEGIN:
+            name, argname = BEGIN[etype]
+            out.append(dict(common, name=name, ph="B", args={argname: arg} if argname else {}))
+        elif etype in END:
+            out.append(dict(common, name=END[etype], ph="E"))
+        elif etype == LOCK_ACQUIRE:
+            # The wait ends at the acquire timestamp, the hold lasts until release
+            out.append(dict(common, name="stream lock wait", ph="X", ts=ts - arg / 1000.0, dur=arg / 1000.0))
+            out.append(dict(common, name="stream lock held", ph="B"))
+        elif etype == LOCK_RELEASE:
+            out.append(dict(common, name="stream lock held", ph="E"))
+    return {"traceEvents": out, "displayTimeUnit": "ns"}
+
+
+def main():
+    src = sys.argv[1] if len(sys.argv) > 1 else "/var/tmp/aesdsocket.trace"
+    with open(src, "rb") as f:
+        trace = convert(f.read())
+    if len(sys.argv) > 2:
+        with open(sys.argv[2], "w") as f:
+            json.dump(trace, f)
+    else:
+        json.dump(trace, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,64 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <time.h>
+#include <sys/wait.h>
+#include "../../examples/systemcalls/systemcalls.h"
+
+static double elapsed_since(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+* Each command gets its own status, and one failing command does not stop the others
+*/
+void test_exec_batch_status()
+{
+    char * const ok[] = { "/bin/true", NULL };
+    char * const fails[] = { "/bin/false", NULL };
+    char * const exits3[] = { "/bin/sh", "-c", "exit 3", NULL };
+    char * const missing[] = { "/nonexistent/command", NULL };
+    struct exec_batch_cmd cmds[] = {
+        { .argv = ok }, { .argv = fails }, { .argv = exits3 }, { .argv = missing }, { .argv = ok },
+    };
+
+    TEST_ASSERT_FALSE_MESSAGE(do_exec_batch(cmds, 5, 2), "a batch with failing commands should fail");
+    TEST_ASSERT_TRUE_MESSAGE(cmds[0].success, "/bin/true should succeed");
+    TEST_ASSERT_TRUE(WIFEXITED(cmds[0].status) && WEXITSTATUS(cmds[0].status) == 0);
+    TEST_ASSERT_FALSE_MESSAGE(cmds[1].success, "/bin/false should fail");
+    TEST_ASSERT_TRUE(WIFEXITED(cmds[1].status) && WEXITSTATUS(cmds[1].status) == 1);
+    TEST_ASSERT_FALSE(cmds[2].success);
+    TEST_ASSERT_TRUE_MESSAGE(WIFEXITED(cmds[2].status) && WEXITSTATUS(cmds[2].status) == 3,
+                             "exit status should be reported per command");
+    TEST_ASSERT_FALSE(cmds[3].success);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(-1, cmds[3].status, "a command that cannot start should have status -1");
+    TEST_ASSERT_TRUE_MESSAGE(cmds[4].success, "commands after a failure should still run");
+
+    struct exec_batch_cmd good[] = { { .argv = ok }, { .argv = ok } };
+    TEST_ASSERT_TRUE_MESSAGE(do_exec_batch(good, 2, 0), "a batch of successful commands should succeed");
+    TEST_ASSERT_TRUE_MESSAGE(do_exec_batch(NULL, 0, 0), "an empty batch should succeed");
+}
+
+/**
+* No more than max_parallel commands run at once, and 0 runs them all together
+*/
+void test_exec_batch_parallel_cap()
+{
+    char * const nap[] = { "/bin/sh", "-c", "sleep 0.4", NULL };
+    struct exec_batch_cmd cmds[4] = {
+        { .argv = nap }, { .argv = nap }, { .argv = nap }, { .argv = nap },
+    };
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    TEST_ASSERT_TRUE(do_exec_batch(cmds, 4, 2));
+    double capped = elapsed_since(&start);
+    TEST_ASSERT_TRUE_MESSAGE(capped >= 0.75, "four 0.4s commands two at a time should take two rounds");
+    TEST_ASSERT_TRUE_MESSAGE(capped < 1.2, "two at a time should not run the commands one by one");
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    TEST_ASSERT_TRUE(do_exec_batch(cmds, 4, 0));
+    TEST_ASSERT_TRUE_MESSAGE(elapsed_since(&start) < 0.75, "no limit should run all four at once");
+}
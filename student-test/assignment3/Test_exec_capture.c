@@ -0,0 +1,124 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../../examples/systemcalls/systemcalls.h"
+
+static double elapsed_since(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+* Standard out and standard error are captured separately, along with the exit status
+*/
+void test_exec_capture_stdout_stderr()
+{
+    struct exec_capture capture;
+
+    memset(&capture, 0, sizeof(capture));
+    TEST_ASSERT_TRUE(do_exec_capture(&capture, 3, "/bin/sh", "-c", "echo out; echo err >&2"));
+    TEST_ASSERT_EQUAL_STRING("out\n", capture.out.data);
+    TEST_ASSERT_EQUAL_STRING("err\n", capture.err.data);
+    TEST_ASSERT_FALSE(capture.truncated);
+    TEST_ASSERT_FALSE(capture.timed_out);
+    exec_capture_free(&capture);
+
+    memset(&capture, 0, sizeof(capture));
+    TEST_ASSERT_FALSE_MESSAGE(do_exec_capture(&capture, 3, "/bin/sh", "-c", "echo partial; exit 2"),
+                              "a non-zero exit status should fail");
+    TEST_ASSERT_EQUAL_STRING("partial\n", capture.out.data);
+    TEST_ASSERT_TRUE(WIFEXITED(capture.status) && WEXITSTATUS(capture.status) == 2);
+    exec_capture_free(&capture);
+
+    memset(&capture, 0, sizeof(capture));
+    TEST_ASSERT_FALSE_MESSAGE(do_exec_capture(&capture, 1, "/nonexistent/command"),
+                              "a command that cannot start should fail");
+    TEST_ASSERT_EQUAL_INT(-1, capture.status);
+    exec_capture_free(&capture);
+}
+
+/**
+* A command writing more than max_bytes is killed after exactly max_bytes are kept
+*/
+void test_exec_capture_max_bytes()
+{
+    struct exec_capture capture;
+
+    memset(&capture, 0, sizeof(capture));
+    capture.max_bytes = 1000;
+    TEST_ASSERT_FALSE(do_exec_capture(&capture, 1, "/usr/bin/yes"));
+    TEST_ASSERT_TRUE(capture.truncated);
+    TEST_ASSERT_FALSE(capture.timed_out);
+    TEST_ASSERT_EQUAL_UINT(1000, capture.out.len + capture.err.len);
+    TEST_ASSERT_EQUAL_MEMORY("y\ny\n", capture.out.data, 4);
+    exec_capture_free(&capture);
+}
+
+/**
+* timeout_ms is enforced while output flows, and after the command has closed its output
+*/
+void test_exec_capture_timeout()
+{
+    struct exec_capture capture;
+    struct timespec start;
+
+    memset(&capture, 0, sizeof(capture));
+    capture.timeout_ms = 300;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    TEST_ASSERT_FALSE(do_exec_capture(&capture, 2, "/bin/sleep", "3"));
+    TEST_ASSERT_TRUE(capture.timed_out);
+    TEST_ASSERT_TRUE_MESSAGE(elapsed_since(&start) < 2.0, "the command should be killed at the timeout");
+    exec_capture_free(&capture);
+
+    memset(&capture, 0, sizeof(capture));
+    capture.timeout_ms = 300;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    TEST_ASSERT_FALSE(do_exec_capture(&capture, 3, "/bin/sh", "-c", "exec >&- 2>&-; sleep 3"));
+    TEST_ASSERT_TRUE_MESSAGE(capture.timed_out, "closing stdout and stderr should not escape the timeout");
+    TEST_ASSERT_TRUE(elapsed_since(&start) < 2.0);
+    exec_capture_free(&capture);
+
+    memset(&capture, 0, sizeof(capture));
+    capture.timeout_ms = 2000;
+    TEST_ASSERT_TRUE_MESSAGE(do_exec_capture(&capture, 3, "/bin/sh", "-c", "echo done"),
+                             "a command finishing in time should succeed");
+    TEST_ASSERT_FALSE(capture.timed_out);
+    exec_capture_free(&capture);
+}
+
+struct collected {
+    char out[64];
+    char err[64];
+};
+
+static void collect(int fd, const char *data, size_t len, void *ctx)
+{
+    struct collected *c = ctx;
+    char *dest = fd == STDOUT_FILENO ? c->out : c->err;
+    strncat(dest, data, len < sizeof(c->out) - strlen(dest) - 1 ? len : sizeof(c->out) - strlen(dest) - 1);
+}
+
+/**
+* With a callback output is streamed to it, tagged by stream, instead of buffered
+*/
+void test_exec_capture_callback()
+{
+    struct exec_capture capture;
+    struct collected collected;
+
+    memset(&capture, 0, sizeof(capture));
+    memset(&collected, 0, sizeof(collected));
+    capture.callback = collect;
+    capture.ctx = &collected;
+    TEST_ASSERT_TRUE(do_exec_capture(&capture, 3, "/bin/sh", "-c", "echo one; echo two >&2; echo three"));
+    TEST_ASSERT_EQUAL_STRING("one\nthree\n", collected.out);
+    TEST_ASSERT_EQUAL_STRING("two\n", collected.err);
+    TEST_ASSERT_NULL_MESSAGE(capture.out.data, "output should not be buffered when streamed");
+    TEST_ASSERT_NULL(capture.err.data);
+    exec_capture_free(&capture);
+}